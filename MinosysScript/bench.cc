@@ -0,0 +1,181 @@
+#include "engine.h"
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+#include <unistd.h>
+#include <vector>
+#include <string>
+
+using namespace std;
+using namespace minosys;
+
+// 実行環境のマイクロベンチマーク
+// minosysbench <name> [args...]
+
+// 構文解析の速度を測る; パッケージと import 先の各ファイルを runs 回ずつ解析する
+static int benchParse(int argc, char **argv) {
+  vector<string> sp;
+  bool lazy = false;
+  int c;
+  while ((c = getopt(argc, argv, "d:l")) != -1) {
+    switch (c) {
+    case 'd':
+      sp.push_back(optarg);
+      break;
+
+    case 'l':
+      // 関数本体を読み飛ばす
+      lazy = true;
+      break;
+
+    default:
+      return -1;
+    }
+  }
+  argc -= optind;
+  argv += optind;
+  if (argc < 2) return -1;
+  int runs = atoi(argv[0]);
+  if (runs <= 0) return -1;
+
+  Engine eng(sp);
+  eng.useCache = false;	// 測定のために .minosysc を書かない
+  if (!eng.analyzePackage(argv[1], true)) {
+    cout << "package:" << argv[1] << " not found" << endl;
+    return 1;
+  }
+  for (auto p = eng.packages.begin(); p != eng.packages.end(); ++p) {
+    if (p->first.empty() || p->second->ptype != PackageBase::PT_MINOSYS || p->second->path.empty()) continue;
+    size_t ntokens = 0;
+    auto t0 = chrono::steady_clock::now();
+    for (int i = 0; i < runs; ++i) {
+      LexMap lex(p->second->path);
+      TokenBuffer buf;
+      lex.tokenize(buf);
+      ntokens = buf.size();
+    }
+    auto t1 = chrono::steady_clock::now();
+    for (int i = 0; i < runs; ++i) {
+      LexMap lex(p->second->path);
+      ContentTop top;
+      top.lazy = lazy;
+      top.yylex(&lex);
+    }
+    auto t2 = chrono::steady_clock::now();
+    double lexus = chrono::duration<double, micro>(t1 - t0).count() / runs;
+    double parseus = chrono::duration<double, micro>(t2 - t1).count() / runs;
+    cout << "parse " << p->first << ": " << ntokens << " tokens, lex " << lexus << " us, lex+parse " << parseus << " us"
+      << " (" << ntokens / parseus << " Mtokens/s)" << endl;
+  }
+  return 0;
+}
+
+// 配列の hash 部分の表で追加・検索・走査にかかる時間を測る
+template<class M> static void benchMap(const char *name, const vector<VarKey> &keys) {
+  VarPtr v = newVar(1);
+  auto t0 = chrono::steady_clock::now();
+  M m;
+  for (auto p = keys.begin(); p != keys.end(); ++p) {
+    m.emplace(*p, v);
+  }
+  auto t1 = chrono::steady_clock::now();
+  size_t found = 0;
+  for (auto p = keys.begin(); p != keys.end(); ++p) {
+    found += m.find(*p) != m.end();
+  }
+  auto t2 = chrono::steady_clock::now();
+  long sum = 0;
+  for (auto p = m.begin(); p != m.end(); ++p) {
+    sum += p->second->inum;
+  }
+  auto t3 = chrono::steady_clock::now();
+  if (found != keys.size() || sum != (long)keys.size()) {
+    cerr << name << ": bad result" << endl;
+  }
+  double n = (double)keys.size();
+  cout << "  " << name << ": insert " << chrono::duration<double, nano>(t1 - t0).count() / n << " ns"
+    << ", find " << chrono::duration<double, nano>(t2 - t1).count() / n << " ns"
+    << ", iterate " << chrono::duration<double, nano>(t3 - t2).count() / n << " ns" << endl;
+}
+
+// FlatMap と unordered_map の比較
+static int benchMaps(int, char **) {
+  typedef unordered_map<VarKey, VarPtr, VarKey::Hash> StdHash;
+  for (int n = 1000; n <= 1000000; n *= 10) {
+    vector<VarKey> ikeys, skeys;
+    ikeys.reserve(n);
+    skeys.reserve(n);
+    for (int i = 0; i < n; ++i) {
+      // 整数の添字は list に入らないよう飛び飛びにする
+      ikeys.push_back(VarKey((int)(i * 2654435761u)));
+      skeys.push_back(VarKey("key" + to_string(i)));
+    }
+    cout << "int keys x " << n << endl;
+    benchMap<StdHash>("unordered_map", ikeys);
+    benchMap<VarArray::Hash>("FlatMap", ikeys);
+    cout << "string keys x " << n << endl;
+    benchMap<StdHash>("unordered_map", skeys);
+    benchMap<VarArray::Hash>("FlatMap", skeys);
+  }
+  return 0;
+}
+
+// 短い文字列を 1M 回連結する時間を測る
+static int benchConcat(int, char **) {
+  const int n = 1000000;
+  const string piece = "ab";
+  auto t0 = chrono::steady_clock::now();
+  // $s = $s + "ab"
+  VarPtr s = newVar(string());
+  for (int i = 0; i < n; ++i) {
+    s = s->concat(piece);
+  }
+  auto t1 = chrono::steady_clock::now();
+  size_t len = s->str().size();
+  auto t2 = chrono::steady_clock::now();
+  // $a += "ab"
+  VarPtr a = newVar(string());
+  for (int i = 0; i < n; ++i) {
+    a->appendStr(piece);
+  }
+  auto t3 = chrono::steady_clock::now();
+  if (len != piece.size() * n || a->str() != s->str()) {
+    cerr << "concat: bad result" << endl;
+  }
+  cout << "concat x " << n << ": + " << chrono::duration<double, milli>(t1 - t0).count() << " ms"
+    << " (flatten " << chrono::duration<double, milli>(t2 - t1).count() << " ms)"
+    << ", += " << chrono::duration<double, milli>(t3 - t2).count() << " ms" << endl;
+  return 0;
+}
+
+struct Bench {
+  const char *name;
+  const char *args;
+  int (*func)(int argc, char **argv);	// 引数が誤っていれば -1
+};
+
+static const Bench benches[] = {
+  { "parse", "[-d <dir>] [-l] <runs> <file>", benchParse },
+  { "map", "", benchMaps },
+  { "concat", "", benchConcat },
+};
+
+int main(int argc, char **argv) {
+  int n = sizeof(benches) / sizeof(benches[0]);
+  if (argc >= 2) {
+    for (int i = 0; i < n; ++i) {
+      if (strcmp(benches[i].name, argv[1]) == 0) {
+        int r = benches[i].func(argc - 1, argv + 1);
+        if (r >= 0) return r;
+        cout << "usage: minosysbench " << benches[i].name << " " << benches[i].args << endl;
+        return 1;
+      }
+    }
+  }
+  for (int i = 0; i < n; ++i) {
+    cout << (i == 0 ? "usage: " : "       ") << "minosysbench " << benches[i].name << " " << benches[i].args << endl;
+  }
+  return 1;
+}
@@ -0,0 +1,136 @@
+#ifndef BYTECODE_H_
+#define BYTECODE_H_
+
+#include "content.h"
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+
+namespace minosys {
+
+// bytecode 命令
+// r[x] はレジスタ、s[x] は文字列テーブル、y[x] は Engine::symbols の識別子を表す
+enum OpCode : uint8_t {
+  OC_NOP = 0,
+  OC_LOADNULL,		// r[a] = null
+  OC_LOADINT,		// r[a] = b
+  OC_LOADDNUM,		// r[a] = dnums[b]
+  OC_LOADSTR,		// r[a] = s[b]
+  OC_LOADCONST,		// r[a] = consts[b]; パッケージの定数表
+  OC_LOADFUNC,		// r[a] = y[b].y[c]
+  OC_FUNCTAG,		// r[a] = (カレントパッケージ).y[b]
+  OC_MEMBER,		// r[a] = r[a].y[b]
+  OC_GETVAR,		// r[a] = nodes[b] (LT_VAR)
+  OC_DECLVAR,		// nodes[b][r[c]]..[r[c+n-1]] がなければ作成する
+  OC_JNARRAY,		// r[a] が配列でなければ b へ
+  OC_INDEX,		// r[a] = r[a][r[c]]; 添字が不正なら b へ
+  OC_EVAL,		// r[a] = evaluate(nodes[b]); tree walker へ委譲する
+
+  // 単項演算子: r[a] = op r[b]
+  OC_NOT,
+  OC_NEGATE,
+  OC_MINUS,
+  OC_TRUTH,		// r[a] = r[b] が真なら 1、偽なら 0
+
+  // 二項演算子: r[a] = r[b] op r[c]
+  OC_LT,
+  OC_LTEQ,
+  OC_GT,
+  OC_GTEQ,
+  OC_NEQ,
+  OC_EQ,
+  OC_PLUS,
+  OC_MINUS2,
+  OC_MULTIPLY,
+  OC_DIV,
+  OC_MOD,
+  OC_AND,
+  OC_OR,
+  OC_XOR,
+  OC_LSH,
+  OC_RSH,
+
+  // 代入演算子: nodes[b][r[c]]..[r[c+n-1]] op= r[a]; 結果は r[a]
+  OC_ASSIGN,
+  OC_ASSIGNPLUS,
+  OC_ASSIGNMINUS,
+  OC_ASSIGNMULTIPLY,
+  OC_ASSIGNDIV,
+  OC_ASSIGNMOD,
+  OC_ASSIGNAND,
+  OC_ASSIGNOR,
+  OC_ASSIGNXOR,
+  OC_ASSIGNLSH,
+  OC_ASSIGNRSH,
+
+  // 増減演算子: r[a] = op nodes[b][r[c]]..[r[c+n-1]]
+  OC_PREINCR,
+  OC_POSTINCR,
+  OC_PREDECR,
+  OC_POSTDECR,
+
+  // 制御
+  OC_JMP,		// b へ
+  OC_JMPF,		// r[a] が偽なら b へ
+  OC_JMPT,		// r[a] が真なら b へ
+  OC_CALLPREP,		// 呼び出し対象 r[a] を確認し、レシーバを r[a+1] に置く
+  OC_CALL,		// r[b] = r[a](r[a+1], r[a+2]..r[a+n+1])
+  OC_RET,		// r[a] を返す
+  OC_RETNULL		// null を返す
+};
+
+struct Instruction {
+  OpCode code;
+  uint8_t n;
+  uint16_t a;
+  int32_t b, c;
+};
+
+// 関数ひとつ分の bytecode
+struct ByteCode {
+  Content *def;			// LT_FUNCDEF
+  int nregs;
+  std::vector<Instruction> code;
+  std::vector<std::string> strs;
+  std::vector<double> dnums;
+  std::vector<Content *> nodes;
+  ByteCode(Content *def) : def(def), nregs(0) {}
+};
+
+// 平坦化した構文木 (FlatTree) から bytecode を生成する
+class Compiler {
+ public:
+  ByteCode *compile(const FlatTree &tree, uint32_t def);
+
+ private:
+  struct Loop {
+    uint32_t c;
+    std::vector<int> breaks;
+    std::vector<int> continues;
+    Loop(uint32_t c) : c(c) {}
+  };
+  const FlatTree *t;
+  ByteCode *bc;
+  int nextReg;
+  std::vector<Loop> loops;
+  std::unordered_map<std::string, int> strmap;
+
+  void compileBlock(uint32_t c);
+  void compileStatement(uint32_t c);
+  void compileExpr(uint32_t c, int dst);
+  void compileOp(uint32_t c, int dst);
+  void compileIndex(uint32_t c, int first, int dst);
+  void compileCall(uint32_t c, int dst);
+  bool compileLHS(uint32_t lhs, int &base);
+  int emit(OpCode code, int a, int b = 0, int c = 0, int n = 0);
+  int here() { return (int)bc->code.size(); }
+  void patch(int at, int target) { bc->code[at].b = target; }
+  int allocReg(int count = 1);
+  int addString(const std::string &s);
+  int addNode(uint32_t c);
+};
+
+} // minosys
+
+#endif // BYTECODE_H_
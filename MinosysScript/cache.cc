@@ -0,0 +1,379 @@
+#include "content.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+using namespace minosys;
+
+// 事前コンパイル済みパッケージ (<package>.minosysc)
+//
+// header: "MSC1", version, SourceStamp, 以降の内容の hash
+// 文字列表, 実数表, ノード列 (FlatTree と同じ添字), imports, funcs, defines
+// 数値はすべて実行環境のバイト順で書く; 別環境のキャッシュは version で弾く
+
+static const char CACHE_MAGIC[4] = { 'M', 'S', 'C', '1' };
+static const uint32_t CACHE_VERSION = 1 | (sizeof(void *) << 8);
+static const size_t HEADER_SIZE = 40;
+static const uint32_t NONE = 0xffffffff;
+static const uint8_t TAG_EMPTY = 0xff;	// 空の子
+
+// FNV-1a
+static uint64_t hashBytes(const void *p, size_t size) {
+  const unsigned char *d = (const unsigned char *)p;
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < size; ++i) {
+    h = (h ^ d[i]) * 1099511628211ULL;
+  }
+  return h;
+}
+
+bool SourceStamp::read(const string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat sb;
+  if (fstat(fd, &sb) < 0) {
+    close(fd);
+    return false;
+  }
+  size = (uint64_t)sb.st_size;
+  mtime = (int64_t)sb.st_mtime;
+  hash = hashBytes(NULL, 0);
+  if (size > 0) {
+    void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      close(fd);
+      return false;
+    }
+    hash = hashBytes(p, size);
+    munmap(p, size);
+  }
+  close(fd);
+  return true;
+}
+
+namespace {
+
+class Writer {
+ public:
+  string buf;
+  template<class T> void put(const T &v) {
+    buf.append((const char *)&v, sizeof(T));
+  }
+  void putString(const string &s) {
+    put((uint32_t)s.size());
+    buf.append(s);
+  }
+};
+
+class Reader {
+ public:
+  const char *p, *end;
+  bool ok;
+  Reader(const char *p, size_t size) : p(p), end(p + size), ok(true) {}
+  template<class T> T get() {
+    T v = T();
+    if (end - p < (ptrdiff_t)sizeof(T)) {
+      ok = false;
+      return v;
+    }
+    memcpy(&v, p, sizeof(T));
+    p += sizeof(T);
+    return v;
+  }
+  string getString() {
+    uint32_t len = get<uint32_t>();
+    if (!ok || end - p < (ptrdiff_t)len) {
+      ok = false;
+      return string();
+    }
+    string s(p, len);
+    p += len;
+    return s;
+  }
+};
+
+} // namespace
+
+bool ContentTop::saveCache(const string &path, const SourceStamp &st) const {
+  string buf;
+  if (!encodeCache(buf, st)) return false;
+
+  // 書き込み途中のファイルを読まれないよう rename で置き換える
+  // 同じパッケージを複数のプロセスが同時に保存しても混ざらないよう、一時ファイルは毎回別に作る
+  string tmp = path + ".XXXXXX";
+  int fd = mkstemp(&tmp[0]);
+  if (fd < 0) return false;
+  fchmod(fd, 0644);
+  FILE *f = fdopen(fd, "wb");
+  if (!f) {
+    close(fd);
+    unlink(tmp.c_str());
+    return false;
+  }
+  bool ok = fwrite(buf.data(), 1, buf.size(), f) == buf.size();
+  ok = (fclose(f) == 0) && ok;
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool ContentTop::loadCache(const string &path, const SourceStamp &st) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat sb;
+  if (fstat(fd, &sb) < 0 || sb.st_size < (off_t)HEADER_SIZE) {
+    close(fd);
+    return false;
+  }
+  size_t size = (size_t)sb.st_size;
+  void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return false;
+  bool ok = decodeCache((const char *)map, size, st);
+  munmap(map, size);
+  return ok;
+}
+
+// キャッシュの内容を buf に作る; アーカイブにもこの形式で格納する
+bool ContentTop::encodeCache(string &buf, const SourceStamp &st) const {
+  if (!lazyBodies.empty()) {
+    // 本体が未解析の関数があるうちは保存できない
+    return false;
+  }
+  Writer w;
+  w.buf.append(CACHE_MAGIC, 4);
+  w.put(CACHE_VERSION);
+  w.put(st.size);
+  w.put(st.mtime);
+  w.put(st.hash);
+  w.put((uint64_t)0);	// 内容の hash; 最後に書く
+
+  FlatTree flat;
+  flatten(flat);
+  w.put((uint32_t)flat.strs.size());
+  for (auto p = flat.strs.begin(); p != flat.strs.end(); ++p) {
+    w.putString(*p);
+  }
+  w.put((uint32_t)flat.dnums.size());
+  for (auto p = flat.dnums.begin(); p != flat.dnums.end(); ++p) {
+    w.put(*p);
+  }
+
+  // ノード; 添字 0 は番兵なので書かない
+  uint32_t n = (uint32_t)flat.nodes.size();
+  w.put(n);
+  for (uint32_t i = 1; i < n; ++i) {
+    const FlatNode &f = flat[i];
+    w.put(flat.origin[i] ? f.tag : TAG_EMPTY);
+    w.put(f.opcode);
+    w.put(f.nchild);
+    w.put(f.child);
+    w.put(f.next);
+    w.put(f.value);
+  }
+  w.put((uint32_t)flat.labels.size());
+  for (auto p = flat.labels.begin(); p != flat.labels.end(); ++p) {
+    w.put(p->first);
+    w.putString(p->second);
+  }
+  w.put((uint32_t)flat.args.size());
+  for (auto p = flat.args.begin(); p != flat.args.end(); ++p) {
+    w.put(p->first);
+    w.put((uint32_t)p->second.size());
+    for (auto pa = p->second.begin(); pa != p->second.end(); ++pa) {
+      w.putString(*pa);
+    }
+  }
+
+  w.put((uint32_t)imports.size());
+  for (auto p = imports.begin(); p != imports.end(); ++p) {
+    w.putString(*p);
+  }
+  w.put((uint32_t)funcs.size());
+  for (auto p = funcs.begin(); p != funcs.end(); ++p) {
+    w.putString(arena.symbols->name(p->first));
+    w.put(flat.index(p->second));
+  }
+  w.put((uint32_t)defines.size());
+  for (auto p = defines.begin(); p != defines.end(); ++p) {
+    MinosysClassDef *def = p->second;
+    w.putString(p->first);
+    w.put((uint32_t)def->parentClass.size());
+    for (auto pp = def->parentClass.begin(); pp != def->parentClass.end(); ++pp) {
+      w.putString(*pp);
+    }
+    w.put((uint32_t)def->vars.size());
+    for (auto pv = def->vars.begin(); pv != def->vars.end(); ++pv) {
+      w.putString(*pv);
+    }
+    w.put((uint32_t)def->members.size());
+    for (auto pm = def->members.begin(); pm != def->members.end(); ++pm) {
+      w.putString(pm->first);
+      w.put(flat.index(pm->second));
+    }
+  }
+
+  uint64_t h = hashBytes(w.buf.data() + HEADER_SIZE, w.buf.size() - HEADER_SIZE);
+  memcpy(&w.buf[HEADER_SIZE - sizeof(h)], &h, sizeof(h));
+  buf.swap(w.buf);
+  return true;
+}
+
+// data の内容から構文木を復元する; st と一致しなければ false
+bool ContentTop::decodeCache(const char *data, size_t size, const SourceStamp &st) {
+  if (size < HEADER_SIZE) return false;
+  Reader r(data, size);
+  bool ok = memcmp(r.p, CACHE_MAGIC, 4) == 0;
+  r.p += 4;
+  ok = ok && r.get<uint32_t>() == CACHE_VERSION;
+  ok = ok && r.get<uint64_t>() == st.size;
+  ok = ok && r.get<int64_t>() == st.mtime;
+  ok = ok && r.get<uint64_t>() == st.hash;
+  // source が同じでもキャッシュ自体が壊れていることがあるので、ノードを作る前に確かめる
+  ok = ok && r.get<uint64_t>() == hashBytes(data + HEADER_SIZE, size - HEADER_SIZE);
+
+  vector<IString> strs;
+  vector<double> dnums;
+  vector<Content *> nodes;
+  vector<FlatNode> links;
+  if (ok) {
+    uint32_t ns = r.get<uint32_t>();
+    for (uint32_t i = 0; r.ok && i < ns; ++i) {
+      strs.push_back(arena.intern(r.getString()));
+    }
+    uint32_t nd = r.get<uint32_t>();
+    for (uint32_t i = 0; r.ok && i < nd; ++i) {
+      dnums.push_back(r.get<double>());
+    }
+
+    // ノードを作成し、つなぐのは全部読んでから行う
+    uint32_t n = r.get<uint32_t>();
+    if (r.ok && n > 0 && (size_t)(r.end - r.p) >= (size_t)(n - 1) * 16) {
+      nodes.resize(n);
+      links.resize(n);
+      for (uint32_t i = 1; r.ok && i < n; ++i) {
+        FlatNode &f = links[i];
+        f.tag = r.get<uint8_t>();
+        f.opcode = r.get<uint8_t>();
+        f.nchild = r.get<uint16_t>();
+        f.child = r.get<uint32_t>();
+        f.next = r.get<uint32_t>();
+        f.value = r.get<uint32_t>();
+        if (f.tag == TAG_EMPTY) {
+          nodes[i] = NULL;
+        } else if (f.tag == LexBase::LT_INT) {
+          nodes[i] = new (&arena) Content(&arena, (int)f.value);
+        } else if (f.tag == LexBase::LT_DNUM) {
+          if (f.value >= dnums.size()) r.ok = false;
+          else nodes[i] = new (&arena) Content(&arena, dnums[f.value]);
+        } else {
+          if (f.value >= strs.size()) r.ok = false;
+          else nodes[i] = new (&arena) Content(&arena, (LexBase::LexTag)f.tag, strs[f.value]);
+        }
+      }
+      // FlatTree は子と後続を親より後ろに置き、各ノードの親はひとつだけ
+      // これを満たさないリンクは循環や共有になるので受け付けない
+      vector<bool> linked(n);
+      for (uint32_t i = 1; r.ok && i < n; ++i) {
+        const FlatNode &f = links[i];
+        Content *c = nodes[i];
+        if (!c) continue;
+        if (f.next >= n || (f.next != 0 && f.next <= i)
+          || (f.nchild > 0 && (f.child <= i || (uint64_t)f.child + f.nchild > n))) {
+          r.ok = false;
+          break;
+        }
+        for (int k = 0; r.ok && k < f.nchild; ++k) {
+          if (linked[f.child + k]) r.ok = false;
+          linked[f.child + k] = true;
+        }
+        if (f.next) {
+          if (linked[f.next]) r.ok = false;
+          linked[f.next] = true;
+        }
+        if (!r.ok) break;
+        for (int k = 0; k < f.nchild; ++k) {
+          c->pc.push_back(nodes[f.child + k]);
+        }
+        if (f.next) {
+          c->next = nodes[f.next];
+        }
+      }
+    } else {
+      r.ok = false;
+    }
+
+    uint32_t nl = r.get<uint32_t>();
+    for (uint32_t i = 0; r.ok && i < nl; ++i) {
+      uint32_t idx = r.get<uint32_t>();
+      string s = r.getString();
+      if (idx >= nodes.size() || !nodes[idx]) r.ok = false;
+      else nodes[idx]->label = arena.intern(s);
+    }
+    uint32_t na = r.get<uint32_t>();
+    for (uint32_t i = 0; r.ok && i < na; ++i) {
+      uint32_t idx = r.get<uint32_t>();
+      uint32_t cnt = r.get<uint32_t>();
+      if (idx >= nodes.size() || !nodes[idx]) {
+        r.ok = false;
+        break;
+      }
+      for (uint32_t k = 0; r.ok && k < cnt; ++k) {
+        nodes[idx]->arg.push_back(arena.intern(r.getString()));
+      }
+    }
+
+    uint32_t ni = r.get<uint32_t>();
+    for (uint32_t i = 0; r.ok && i < ni; ++i) {
+      imports.push_back(r.getString());
+    }
+    uint32_t nf = r.get<uint32_t>();
+    for (uint32_t i = 0; r.ok && i < nf; ++i) {
+      string name = r.getString();
+      uint32_t idx = r.get<uint32_t>();
+      if (idx >= nodes.size() || !nodes[idx]) r.ok = false;
+      else funcs[arena.intern(name).id()] = nodes[idx];
+    }
+    uint32_t nc = r.get<uint32_t>();
+    for (uint32_t i = 0; r.ok && i < nc; ++i) {
+      string cname = r.getString();
+      MinosysClassDef *def = new (arena.alloc(sizeof(MinosysClassDef))) MinosysClassDef();
+      defines[cname] = def;
+      uint32_t np = r.get<uint32_t>();
+      for (uint32_t k = 0; r.ok && k < np; ++k) {
+        def->parentClass.push_back(r.getString());
+      }
+      uint32_t nv = r.get<uint32_t>();
+      for (uint32_t k = 0; r.ok && k < nv; ++k) {
+        def->vars.push_back(r.getString());
+      }
+      uint32_t nm = r.get<uint32_t>();
+      for (uint32_t k = 0; r.ok && k < nm; ++k) {
+        string mname = r.getString();
+        uint32_t idx = r.get<uint32_t>();
+        if (idx >= nodes.size() || !nodes[idx]) r.ok = false;
+        else def->members[mname] = nodes[idx];
+      }
+    }
+    ok = r.ok;
+  }
+
+  if (!ok) {
+    // 壊れたキャッシュ; 読み込んだ分は捨てて構文解析からやり直す
+    imports.clear();
+    funcs.clear();
+    for (auto p = defines.begin(); p != defines.end(); ++p) {
+      p->second->~MinosysClassDef();
+    }
+    defines.clear();
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,438 @@
+#include "bytecode.h"
+
+using namespace std;
+using namespace minosys;
+
+// 式 c の中に変数 name が現れるか
+static bool refersVar(const FlatTree &t, uint32_t c, const string &name) {
+  const FlatNode &f = t[c];
+  if (f.tag == LexBase::LT_VAR && t.str(c) == name) return true;
+  for (int k = 0; k < f.nchild; ++k) {
+    if (refersVar(t, t.child(c, k), name)) return true;
+  }
+  return false;
+}
+
+// 関数定義 (LT_FUNCDEF) を bytecode に変換する
+// def は tree 内の添字
+ByteCode *Compiler::compile(const FlatTree &tree, uint32_t def) {
+  t = &tree;
+  bc = new ByteCode(tree.origin[def]);
+  nextReg = 0;
+  loops.clear();
+  strmap.clear();
+  if (tree[def].nchild > 0) {
+    compileBlock(tree.child(def, 0));
+  }
+  emit(OC_RETNULL, 0);
+  return bc;
+}
+
+int Compiler::emit(OpCode code, int a, int b, int c, int n) {
+  Instruction i;
+  i.code = code;
+  i.n = (uint8_t)n;
+  i.a = (uint16_t)a;
+  i.b = b;
+  i.c = c;
+  bc->code.push_back(i);
+  return (int)bc->code.size() - 1;
+}
+
+// 連続した count 個のレジスタを確保する
+// 解放は nextReg を呼び出し前の値に戻すことで行う
+int Compiler::allocReg(int count) {
+  int r = nextReg;
+  nextReg += count;
+  if (nextReg > bc->nregs) {
+    bc->nregs = nextReg;
+  }
+  return r;
+}
+
+int Compiler::addString(const string &s) {
+  auto p = strmap.find(s);
+  if (p != strmap.end()) {
+    return p->second;
+  }
+  int idx = (int)bc->strs.size();
+  bc->strs.push_back(s);
+  strmap[s] = idx;
+  return idx;
+}
+
+int Compiler::addNode(uint32_t c) {
+  bc->nodes.push_back(t->origin[c]);
+  return (int)bc->nodes.size() - 1;
+}
+
+// next でつながった文の列
+void Compiler::compileBlock(uint32_t c) {
+  for (; c; c = (*t)[c].next) {
+    compileStatement(c);
+  }
+}
+
+void Compiler::compileStatement(uint32_t c) {
+  int mark = nextReg;
+  const FlatNode &f = (*t)[c];
+
+  switch (f.tag) {
+  case LexBase::LT_NL:
+    break;
+
+  case LexBase::LT_BEGIN:
+    if ((*t)[c].nchild > 0) {
+      compileBlock(t->child(c, 0));
+    }
+    break;
+
+  case LexBase::LT_IF:
+    {
+      int r = allocReg();
+      compileExpr(t->child(c, 0), r);
+      int jf = emit(OC_JMPF, r);
+      nextReg = mark;
+      compileBlock(t->child(c, 1));
+      if ((*t)[c].nchild == 3) {
+        int je = emit(OC_JMP, 0);
+        patch(jf, here());
+        compileBlock(t->child(c, 2));
+        patch(je, here());
+      } else {
+        patch(jf, here());
+      }
+    }
+    break;
+
+  case LexBase::LT_FOR:
+    {
+      int r = allocReg();
+      compileExpr(t->child(c, 0), r);
+      int top = here();
+      compileExpr(t->child(c, 1), r);
+      int jf = emit(OC_JMPF, r);
+      nextReg = mark;
+      loops.push_back(Loop(c));
+      compileBlock(t->child(c, 3));
+      int cont = here();
+      r = allocReg();
+      compileExpr(t->child(c, 2), r);
+      nextReg = mark;
+      emit(OC_JMP, 0, top);
+      Loop &l = loops.back();
+      for (auto p = l.continues.begin(); p != l.continues.end(); ++p) {
+        patch(*p, cont);
+      }
+      for (auto p = l.breaks.begin(); p != l.breaks.end(); ++p) {
+        patch(*p, here());
+      }
+      patch(jf, here());
+      loops.pop_back();
+    }
+    break;
+
+  case LexBase::LT_WHILE:
+    {
+      int top = here();
+      int r = allocReg();
+      compileExpr(t->child(c, 0), r);
+      int jf = emit(OC_JMPF, r);
+      nextReg = mark;
+      loops.push_back(Loop(c));
+      compileBlock(t->child(c, 1));
+      emit(OC_JMP, 0, top);
+      Loop &l = loops.back();
+      for (auto p = l.continues.begin(); p != l.continues.end(); ++p) {
+        patch(*p, top);
+      }
+      for (auto p = l.breaks.begin(); p != l.breaks.end(); ++p) {
+        patch(*p, here());
+      }
+      patch(jf, here());
+      loops.pop_back();
+    }
+    break;
+
+  case LexBase::LT_BREAK:
+  case LexBase::LT_CONTINUE:
+    {
+      // ラベル指定があればそのラベルを持つループ、なければ最も内側のループ
+      int i;
+      for (i = (int)loops.size() - 1; i >= 0; --i) {
+        if (t->str(c).empty() || t->label(loops[i].c) == t->str(c)) break;
+      }
+      if (i < 0) {
+        // ループの外では関数を抜ける
+        emit(OC_RETNULL, 0);
+      } else if (f.tag == LexBase::LT_BREAK) {
+        loops[i].breaks.push_back(emit(OC_JMP, 0));
+      } else {
+        loops[i].continues.push_back(emit(OC_JMP, 0));
+      }
+    }
+    break;
+
+  case LexBase::LT_RETURN:
+    if ((*t)[c].nchild >= 1) {
+      int r = allocReg();
+      compileExpr(t->child(c, 0), r);
+      emit(OC_RET, r);
+    } else {
+      emit(OC_RETNULL, 0);
+    }
+    break;
+
+  default: // 演算子
+    compileExpr(c, allocReg());
+  }
+  nextReg = mark;
+}
+
+// 式 c を評価し、結果を dst に置く
+void Compiler::compileExpr(uint32_t c, int dst) {
+  const FlatNode &f = (*t)[c];
+  int slot = t->origin[c] ? t->origin[c]->slot : -1;
+
+  switch (f.tag) {
+  case LexBase::LT_NULL:
+  case LexBase::LT_INT:
+  case LexBase::LT_DNUM:
+  case LexBase::LT_STRING:
+    if (slot >= 0) {
+      // resolve で作成した定数
+      emit(OC_LOADCONST, dst, slot);
+      break;
+    }
+    switch (f.tag) {
+    case LexBase::LT_NULL:
+      emit(OC_LOADNULL, dst);
+      break;
+
+    case LexBase::LT_INT:
+      emit(OC_LOADINT, dst, (int)f.value);
+      break;
+
+    case LexBase::LT_DNUM:
+      emit(OC_LOADDNUM, dst, (int)bc->dnums.size());
+      bc->dnums.push_back(t->dnums[f.value]);
+      break;
+
+    default:
+      emit(OC_LOADSTR, dst, addString(t->str(c)));
+      break;
+    }
+    break;
+
+  case LexBase::LT_VAR:
+    emit(OC_GETVAR, dst, addNode(c));
+    compileIndex(c, 0, dst);
+    break;
+
+  case LexBase::LT_TAG:
+    emit(OC_FUNCTAG, dst, (int)t->str(c).id());
+    break;
+
+  case LexBase::LT_FUNC:
+    compileCall(c, dst);
+    break;
+
+  case LexBase::LT_OP:
+    compileOp(c, dst);
+    break;
+
+  default:
+    emit(OC_EVAL, dst, addNode(c));
+  }
+}
+
+// c の子 [first..] を添字として dst の配列要素をたどる
+void Compiler::compileIndex(uint32_t c, int first, int dst) {
+  int nchild = (*t)[c].nchild;
+  if (nchild <= first) return;
+
+  int mark = nextReg;
+  vector<int> jumps;
+  int r = allocReg();
+  for (int i = first; i < nchild; ++i) {
+    jumps.push_back(emit(OC_JNARRAY, dst));
+    compileExpr(t->child(c, i), r);
+    jumps.push_back(emit(OC_INDEX, dst, 0, r));
+  }
+  for (auto p = jumps.begin(); p != jumps.end(); ++p) {
+    patch(*p, here());
+  }
+  nextReg = mark;
+}
+
+// 関数呼び出し; [0]: 関数名 [1~]: 引数
+void Compiler::compileCall(uint32_t c, int dst) {
+  int nargs = (int)(*t)[c].nchild - 1;
+  if (nargs > 255) {
+    emit(OC_EVAL, dst, addNode(c));
+    return;
+  }
+  int mark = nextReg;
+  int base = allocReg(nargs + 2);
+  compileExpr(t->child(c, 0), base);
+  emit(OC_CALLPREP, base);
+  for (int i = 0; i < nargs; ++i) {
+    compileExpr(t->child(c, i + 1), base + 2 + i);
+  }
+  emit(OC_CALL, base, dst, 0, nargs);
+  nextReg = mark;
+}
+
+// 左辺の添字を連続したレジスタに評価する
+// 単純な変数でない場合は false を返す
+bool Compiler::compileLHS(uint32_t lhs, int &base) {
+  const FlatNode &f = (*t)[lhs];
+  if (f.tag != LexBase::LT_VAR || f.nchild > 255) {
+    return false;
+  }
+  base = allocReg(f.nchild);
+  for (int i = 0; i < f.nchild; ++i) {
+    compileExpr(t->child(lhs, i), base + i);
+  }
+  return true;
+}
+
+void Compiler::compileOp(uint32_t c, int dst) {
+  int mark = nextReg;
+  OpCode code = OC_NOP;
+  const FlatNode &f = (*t)[c];
+
+  switch (f.opcode) {
+  case OT_LT: code = OC_LT; break;
+  case OT_LTEQ: code = OC_LTEQ; break;
+  case OT_GT: code = OC_GT; break;
+  case OT_GTEQ: code = OC_GTEQ; break;
+  case OT_NEQ: code = OC_NEQ; break;
+  case OT_EQ: code = OC_EQ; break;
+  case OT_PLUS: code = OC_PLUS; break;
+  case OT_MINUS: code = OC_MINUS2; break;
+  case OT_MULTIPLY: code = OC_MULTIPLY; break;
+  case OT_DIV: code = OC_DIV; break;
+  case OT_MOD: code = OC_MOD; break;
+  case OT_AND: code = OC_AND; break;
+  case OT_OR: code = OC_OR; break;
+  case OT_XOR: code = OC_XOR; break;
+  case OT_LSH: code = OC_LSH; break;
+  case OT_RSH: code = OC_RSH; break;
+
+  case OT_MONONOT:
+  case OT_NEGATE:
+  case OT_MONOMINUS:
+    compileExpr(t->child(c, 0), dst);
+    emit(f.opcode == OT_MONONOT ? OC_NOT : f.opcode == OT_NEGATE ? OC_NEGATE : OC_MINUS, dst, dst);
+    return;
+
+  case OT_ASSIGN: code = OC_ASSIGN; goto assign;
+  case OT_ASSIGNPLUS: code = OC_ASSIGNPLUS; goto assign;
+  case OT_ASSIGNMINUS: code = OC_ASSIGNMINUS; goto assign;
+  case OT_ASSIGNMULTIPLY: code = OC_ASSIGNMULTIPLY; goto assign;
+  case OT_ASSIGNDIV: code = OC_ASSIGNDIV; goto assign;
+  case OT_ASSIGNMOD: code = OC_ASSIGNMOD; goto assign;
+  case OT_ASSIGNAND: code = OC_ASSIGNAND; goto assign;
+  case OT_ASSIGNOR: code = OC_ASSIGNOR; goto assign;
+  case OT_ASSIGNXOR: code = OC_ASSIGNXOR; goto assign;
+  case OT_ASSIGNLSH: code = OC_ASSIGNLSH; goto assign;
+  case OT_ASSIGNRSH: code = OC_ASSIGNRSH; goto assign;
+  assign:
+    {
+      uint32_t lhs = t->child(c, 0);
+      int base = 0;
+      if (compileLHS(lhs, base)) {
+        int name = addNode(lhs);
+        int n = (*t)[lhs].nchild;
+        if (refersVar(*t, t->child(c, 1), t->str(lhs))) {
+          // tree walker と同様に右辺の評価前に左辺の変数を作成しておく
+          emit(OC_DECLVAR, 0, name, base, n);
+        }
+        compileExpr(t->child(c, 1), dst);
+        emit(code, dst, name, base, n);
+        nextReg = mark;
+        return;
+      }
+    }
+    break;
+
+  case OT_PREINCR: code = OC_PREINCR; goto incr;
+  case OT_POSTINCR: code = OC_POSTINCR; goto incr;
+  case OT_PREDECR: code = OC_PREDECR; goto incr;
+  case OT_POSTDECR: code = OC_POSTDECR; goto incr;
+  incr:
+    {
+      uint32_t lhs = t->child(c, 0);
+      int base = 0;
+      if (compileLHS(lhs, base)) {
+        emit(code, dst, addNode(lhs), base, (*t)[lhs].nchild);
+        nextReg = mark;
+        return;
+      }
+    }
+    break;
+
+  case OT_LOGAND:
+  case OT_LOGOR:
+    {
+      // 短絡評価
+      bool isand = f.opcode == OT_LOGAND;
+      compileExpr(t->child(c, 0), dst);
+      int js = emit(isand ? OC_JMPF : OC_JMPT, dst);
+      compileExpr(t->child(c, 1), dst);
+      emit(OC_TRUTH, dst, dst);
+      int je = emit(OC_JMP, 0);
+      patch(js, here());
+      emit(OC_LOADINT, dst, isand ? 0 : 1);
+      patch(je, here());
+    }
+    return;
+
+  case OT_3TERM:
+    {
+      compileExpr(t->child(c, 0), dst);
+      int jf = emit(OC_JMPF, dst);
+      compileExpr(t->child(c, 1), dst);
+      int je = emit(OC_JMP, 0);
+      patch(jf, here());
+      compileExpr(t->child(c, 2), dst);
+      patch(je, here());
+    }
+    return;
+
+  case OT_LEFTARRAY:
+    compileExpr(t->child(c, 0), dst);
+    compileIndex(c, 1, dst);
+    return;
+
+  case OT_DOT:
+    {
+      uint32_t pac = t->child(c, 0);
+      uint32_t fname = t->child(c, 1);
+      if ((*t)[pac].tag == LexBase::LT_TAG && (*t)[fname].tag == LexBase::LT_TAG) {
+        emit(OC_LOADFUNC, dst, (int)t->str(pac).id(), (int)t->str(fname).id());
+        return;
+      }
+      if ((*t)[fname].tag == LexBase::LT_TAG) {
+        compileExpr(pac, dst);
+        emit(OC_MEMBER, dst, (int)t->str(fname).id());
+        return;
+      }
+    }
+    break;
+  }
+
+  if (code >= OC_LT && code <= OC_RSH) {
+    int r = allocReg();
+    compileExpr(t->child(c, 0), dst);
+    compileExpr(t->child(c, 1), r);
+    emit(code, dst, dst, r);
+    nextReg = mark;
+    return;
+  }
+
+  // その他の演算子は tree walker で評価する
+  nextReg = mark;
+  emit(OC_EVAL, dst, addNode(c));
+}
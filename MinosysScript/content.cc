@@ -5,12 +5,31 @@
 using namespace std;
 using namespace minosys;
 
-MinosysClassDef::~MinosysClassDef() {
-  if (!members.empty()) {
-    for(auto i = members.begin(); i != members.end(); ++i) {
-      delete i->second;
-    }
+// 演算子文字列を OpType に変換する
+OpType minosys::toOpType(const string &op) {
+  static const unordered_map<string, OpType> optypes = {
+    { ".", OT_DOT }, { "?", OT_3TERM },
+    { "=", OT_ASSIGN }, { "+=", OT_ASSIGNPLUS }, { "-=", OT_ASSIGNMINUS },
+    { "*=", OT_ASSIGNMULTIPLY }, { "/=", OT_ASSIGNDIV }, { "%=", OT_ASSIGNMOD },
+    { "&=", OT_ASSIGNAND }, { "|=", OT_ASSIGNOR }, { "^=", OT_ASSIGNXOR },
+    { "<<=", OT_ASSIGNLSH }, { ">>=", OT_ASSIGNRSH },
+    { "!", OT_MONONOT }, { "~", OT_NEGATE }, { "-m", OT_MONOMINUS },
+    { "++x", OT_PREINCR }, { "x++", OT_POSTINCR },
+    { "--x", OT_PREDECR }, { "x--", OT_POSTDECR },
+    { "<", OT_LT }, { "<=", OT_LTEQ }, { ">", OT_GT }, { ">=", OT_GTEQ },
+    { "!=", OT_NEQ }, { "==", OT_EQ },
+    { "+", OT_PLUS }, { "-", OT_MINUS }, { "*", OT_MULTIPLY },
+    { "/", OT_DIV }, { "%", OT_MOD },
+    { "&", OT_AND }, { "|", OT_OR }, { "^", OT_XOR },
+    { "&&", OT_LOGAND }, { "||", OT_LOGOR },
+    { "<<", OT_LSH }, { ">>", OT_RSH },
+    { "[", OT_LEFTARRAY }, { "array", OT_ARRAY }, { "new", OT_NEW }
+  };
+  auto p = optypes.find(op);
+  if (p != optypes.end()) {
+    return p->second;
   }
+  return OT_NONE;
 }
 
 string MinosysClassDef::toStringParentClass() {
@@ -40,28 +59,211 @@ string MinosysClassDef::toString(const string &name) {
   return s;
 }
 
-Content::~Content() {
-  if (this->next != this) {
-    delete this->next;
+Arena::Arena(SymbolTable *symbols) : nodes(0), bytes(0), symbols(symbols), cur(NULL), left(0), owned(NULL) {
+  if (!symbols) {
+    this->symbols = owned = new SymbolTable();
+  }
+}
+
+Arena::~Arena() {
+  for (auto p = chunks.begin(); p != chunks.end(); ++p) {
+    free(*p);
+  }
+  delete owned;
+}
+
+// 8 バイト境界で確保する
+void *Arena::alloc(size_t size) {
+  size = (size + 7) & ~(size_t)7;
+  if (size > left) {
+    size_t csize = size > CHUNKSIZE ? size : CHUNKSIZE;
+    cur = (char *)malloc(csize);
+    if (!cur) throw std::bad_alloc();
+    chunks.push_back(cur);
+    left = csize;
+  }
+  void *p = cur;
+  cur += size;
+  left -= size;
+  bytes += size;
+  return p;
+}
+
+IString Arena::intern(const string &s) {
+  return symbols->intern(s);
+}
+
+SymbolTable::SymbolTable() {
+  intern(string());
+}
+
+IString SymbolTable::intern(const string &s) {
+  lock_guard<mutex> g(lock);
+  auto p = index.find(s);
+  if (p == index.end()) {
+    p = index.emplace(s, SymbolEntry()).first;
+    p->second.str = &p->first;
+    p->second.id = (Symbol)entries.size();
+    entries.push_back(&p->second);
   }
-  for (int i = 0; i < pc.size(); ++i) {
-    delete pc[i];
+  return IString(&p->second);
+}
+
+Symbol SymbolTable::find(const string &s) const {
+  lock_guard<mutex> g(lock);
+  auto p = index.find(s);
+  return p != index.end() ? p->second.id : 0;
+}
+
+const string &SymbolTable::name(Symbol id) const {
+  lock_guard<mutex> g(lock);
+  return *entries[id]->str;
+}
+
+size_t SymbolTable::size() const {
+  lock_guard<mutex> g(lock);
+  return entries.size();
+}
+
+ContentTop::~ContentTop() {
+  // Content は arena とともに解放される
+  for (auto p = defines.begin(); p != defines.end(); ++p) {
+    p->second->~MinosysClassDef();
   }
 }
 
 int ContentTop::getContentToken(ContentToken &t, LexBase *lex) {
-  if (!listContent.empty()) {
-    t = listContent.front();
-    listContent.pop_front();
+  if (pending.overflowed()) {
+    // 読み戻しが溢れた; 以降は終端として扱い、yylex() で失敗にする
+    t = ContentToken();
+    return -1;
+  }
+  uint32_t i;
+  if (!pending.empty()) {
+    i = pending.pop();
   } else {
-    LexBase::LexTag tag = lex->analyze();
-    t = ContentToken(tag, lex);
-    if (tag == LexBase::LT_NULL) return -1;
+    i = tokpos;
+    if ((*tokens)[i].tag != LexBase::LT_NULL) {
+      ++tokpos;
+    }
   }
-  return 0;
+  t = ContentToken(*tokens, i);
+  return t.tag == LexBase::LT_NULL ? -1 : 0;
+}
+
+// n 個先のトークンを読まずに返す
+int ContentTop::peekContentToken(ContentToken &t, uint32_t n) {
+  uint32_t i;
+  if (n < pending.size()) {
+    i = pending[n];
+  } else {
+    i = tokpos + (n - pending.size());
+    if (i >= tokens->size()) {
+      i = (uint32_t)tokens->size() - 1;
+    }
+  }
+  t = ContentToken(*tokens, i);
+  return t.tag == LexBase::LT_NULL ? -1 : 0;
 }
 
 Content *ContentTop::yylex(LexBase *lex) {
+  // 先に全体を字句解析し、構文解析はトークン列をたどる
+  TokenBuffer buf;
+  lex->tokenize(buf);
+  tokens = &buf;
+  tokpos = 0;
+  pending = TokenRing();
+  Content *t = yylex_list(lex);
+  tokens = NULL;
+  if (pending.overflowed()) {
+    t = NULL;
+  }
+  pending.clear();
+  return t;
+}
+
+// lex を引き取って解析する; 読み飛ばした本体が残ればソースを閉じずに持っておく
+Content *ContentTop::yylex(unique_ptr<LexBase> lex) {
+  Content *t = yylex(lex.get());
+  if (!lazyBodies.empty() && lex->data()) {
+    source = std::move(lex);
+  }
+  return t;
+}
+
+// 関数本体を読み飛ばし、そのトークンだけを写して記録する
+// 次のトークンが { でない、または対応する } がない場合は何もしない
+bool ContentTop::skipBody(Content *def) {
+  ContentToken token;
+  if (peekContentToken(token, 0) < 0 || token.tag != LexBase::LT_BEGIN) {
+    return false;
+  }
+  getContentToken(token, NULL);
+  uint32_t begin = token.index;
+  int depth = 1;
+  while (depth > 0) {
+    if (getContentToken(token, NULL) < 0) {
+      // 通常の構文解析に任せる
+      pending.clear();
+      tokpos = begin;
+      return false;
+    }
+    if (token.tag == LexBase::LT_BEGIN) {
+      ++depth;
+    } else if (token.tag == LexBase::LT_BEND) {
+      --depth;
+    }
+  }
+  LazyBody &b = lazyBodies[def];
+  b.tokens.src = tokens->src;
+  b.tokens.tokens.reserve(token.index + 2 - begin);
+  for (uint32_t i = begin; i <= token.index; ++i) {
+    Token t = (*tokens)[i];
+    if (t.extra) {
+      // ソースにない文字列は本体の分だけ写す
+      uint32_t offset = (uint32_t)b.tokens.extra.size();
+      b.tokens.extra.append(tokens->extra, t.span.offset, t.span.length);
+      t.span.offset = offset;
+    }
+    b.tokens.tokens.push_back(t);
+  }
+  b.tokens.tokens.push_back(tokens->tokens.back());
+  b.nest = nest;
+  b.func = arena.intern(parseFunc);
+  return true;
+}
+
+// 関数定義 def の本体を返す; 読み飛ばしていればここで構文解析する
+Content *ContentTop::body(Content *def) {
+  auto p = lazyBodies.find(def);
+  if (p == lazyBodies.end()) {
+    return def->pc.empty() ? NULL : def->pc.at(0);
+  }
+  // 本体のトークンは解析が済めば捨てる
+  LazyBody b = std::move(p->second);
+  lazyBodies.erase(p);
+  tokens = &b.tokens;
+  tokpos = 0;
+  pending = TokenRing();
+  nest = b.nest;
+  parseFunc = b.func;
+  Content *c = yylex_block(NULL);
+  if (pending.overflowed()) {
+    c = NULL;
+  }
+  tokens = NULL;
+  pending.clear();
+  nest = 0;
+  parseFunc = "";
+  if (lazyBodies.empty()) {
+    source.reset();
+  }
+  def->pc.push_back(c);
+  return c;
+}
+
+// 文の列; ブロックの中では } の手前まで
+Content *ContentTop::yylex_list(LexBase *lex) {
   Content *c;
   Content *t = NULL;
   while ((c = yylex_block(lex)) != NULL) {
@@ -75,6 +277,126 @@ Content *ContentTop::yylex(LexBase *lex) {
   return t;
 }
 
+// 関数およびクラスメンバー関数を flat に登録する
+// 本体を読み飛ばした関数は含めない
+void ContentTop::flatten(FlatTree &flat) const {
+  for (auto p = funcs.begin(); p != funcs.end(); ++p) {
+    if (parsed(p->second)) {
+      flat.add(p->second);
+    }
+  }
+  for (auto p = defines.begin(); p != defines.end(); ++p) {
+    for (auto pm = p->second->members.begin(); pm != p->second->members.end(); ++pm) {
+      if (parsed(pm->second)) {
+        flat.add(pm->second);
+      }
+    }
+  }
+}
+
+// 関数定義 c を追加し、その添字を返す
+// 関数定義どうしをつなぐ next はたどらない
+uint32_t FlatTree::add(Content *c) {
+  auto p = roots.find(c);
+  if (p != roots.end()) {
+    return p->second;
+  }
+  uint32_t i = alloc(c);
+  fill(i, c);
+  roots[c] = i;
+  return i;
+}
+
+// add() で追加した Content の添字; なければ 0
+uint32_t FlatTree::index(Content *c) const {
+  auto p = roots.find(c);
+  return p != roots.end() ? p->second : 0;
+}
+
+uint32_t FlatTree::alloc(Content *c) {
+  uint32_t i = (uint32_t)nodes.size();
+  nodes.push_back(FlatNode());
+  origin.push_back(c);
+  return i;
+}
+
+uint32_t FlatTree::addString(const IString &s) {
+  auto p = strindex.find(&s.str());
+  if (p != strindex.end()) {
+    return p->second;
+  }
+  uint32_t i = (uint32_t)strs.size();
+  strs.push_back(s);
+  strindex[&s.str()] = i;
+  return i;
+}
+
+// 添字 i に c を置き、c->next 以降を後ろに追加してつなぐ
+void FlatTree::fillChain(uint32_t i, Content *c) {
+  fill(i, c);
+  if (!c) return;
+  for (Content *t = c->next; t; t = t->next) {
+    uint32_t n = alloc(t);
+    nodes[i].next = n;
+    fill(n, t);
+    i = n;
+  }
+}
+
+void FlatTree::fill(uint32_t i, Content *c) {
+  origin[i] = c;
+  if (!c) {
+    FlatNode &f = nodes[i];
+    f.tag = LexBase::LT_NULL;
+    f.opcode = OT_NONE;
+    f.nchild = 0;
+    f.child = f.next = 0;
+    f.value = addString(IString());
+    return;
+  }
+  {
+    FlatNode &f = nodes[i];
+    f.tag = (uint8_t)c->tag;
+    f.opcode = (uint8_t)c->opcode;
+    f.nchild = (uint16_t)c->pc.size();
+    f.next = 0;
+    switch (c->tag) {
+    case LexBase::LT_INT:
+      f.value = (uint32_t)c->inum;
+      break;
+
+    case LexBase::LT_DNUM:
+      f.value = (uint32_t)dnums.size();
+      dnums.push_back(c->dnum);
+      break;
+
+    default:
+      f.value = addString(c->op);
+    }
+  }
+  if (!c->label.empty()) {
+    labels[i] = c->label;
+  }
+  if (!c->arg.empty()) {
+    args[i].assign(c->arg.begin(), c->arg.end());
+  }
+
+  // 子の場所をまとめて確保してから埋める
+  uint32_t base = (uint32_t)nodes.size();
+  for (int k = 0; k < c->pc.size(); ++k) {
+    alloc(c->pc[k]);
+  }
+  nodes[i].child = base;
+  for (int k = 0; k < c->pc.size(); ++k) {
+    fillChain(base + k, c->pc[k]);
+  }
+}
+
+IString FlatTree::label(uint32_t i) const {
+  auto p = labels.find(i);
+  return p != labels.end() ? p->second : IString();
+}
+
 Content *ContentTop::yylex_block(LexBase *lex) {
   LexBase::LexTag tag;
   ContentToken token, token2;
@@ -84,44 +406,38 @@ Content *ContentTop::yylex_block(LexBase *lex) {
   // check label
   if (getContentToken(token, lex) < 0) return NULL;
 
-  if (token.tag == LexBase::LT_TAG) {
-    if (getContentToken(token2, lex) < 0) {
-      listContent.push_back(token);
-    } else if (token2.tag != LexBase::LT_OP || token2.token != ":") {
-      listContent.push_back(token2);
-      listContent.push_back(token);
-    } else {
-      labelname = token.token;
-    }
+  if (token.tag == LexBase::LT_TAG && peekContentToken(token2, 0) >= 0
+   && token2.tag == LexBase::LT_OP && token2.token == ":") {
+    labelname = token.token;
+    getContentToken(token2, lex);
   } else {
-    listContent.push_back(token);
+    pending.unget(token.index);
   }
 
   if (getContentToken(token, lex) >= 0) {
     if (token.tag == LexBase::LT_BEGIN) {
       this->nest++;
-      t = new Content(LexBase::LT_BEGIN, "");
-      t->label = labelname;
-      Content *c = yylex(lex);
+      t = new (&arena) Content(&arena, LexBase::LT_BEGIN, "");
+      t->label = arena.intern(labelname);
+      Content *c = yylex_list(lex);
       if (c) {
         t->pc.push_back(c);
       }
       if (getContentToken(token, lex) < 0
         || token.tag != LexBase::LT_BEND) {
-        delete t;
         t = NULL;
       }
       this->nest--;
     } else if (token.tag == LexBase::LT_BEND) {
-      listContent.push_back(token);
+      pending.requeue(token.index);
     } else {
-      listContent.push_back(token);
+      pending.requeue(token.index);
       t = yylex_sentence(labelname, lex);
     }
   }
   if (!t && !labelname.empty()) {
-    t = new Content(LexBase::LT_NL, "");
-    t->label = labelname;
+    t = new (&arena) Content(&arena, LexBase::LT_NL, "");
+    t->label = arena.intern(labelname);
   }
   if (!labelname.empty()) {
     this->labels[this->parseFunc][labelname] = Label(this->nest, t);
@@ -138,7 +454,7 @@ Content *ContentTop::yylex_sentence(const string &label, LexBase *lex) {
     return NULL;
   }
   if (token.tag == LexBase::LT_NL) {
-    t = new Content(token.tag, token.token);
+    t = new (&arena) Content(&arena, token.tag, token.token);
     return t;
   }
 
@@ -151,7 +467,7 @@ Content *ContentTop::yylex_sentence(const string &label, LexBase *lex) {
           this->defines[cname] = def;
         }
       } else {
-        listContent.push_back(token);
+        pending.requeue(token.index);
       }
     }
     goto loop;
@@ -174,15 +490,14 @@ Content *ContentTop::yylex_sentence(const string &label, LexBase *lex) {
       string varname = token.token;
       if (getContentToken(token, lex) >= 0) {
         if (token.tag == LexBase::LT_NL) {
-          t = new Content(LexBase::LT_TAG, range);
-          t->pc.push_back(new Content(LexBase::LT_VAR, varname));
+          t = new (&arena) Content(&arena, LexBase::LT_TAG, range);
+          t->pc.push_back(new (&arena) Content(&arena, LexBase::LT_VAR, varname));
         } else if (token.tag == LexBase::LT_OP && token.token == "=") {
-          t = new Content(LexBase::LT_TAG, range);
-          t->pc.push_back(new Content(LexBase::LT_VAR, varname));
+          t = new (&arena) Content(&arena, LexBase::LT_TAG, range);
+          t->pc.push_back(new (&arena) Content(&arena, LexBase::LT_VAR, varname));
           t->pc.push_back(yylex_eval(lex));
           if (getContentToken(token, lex) < 0
             || token.tag == LexBase::LT_NL) {
-            delete t;
             t = NULL;
           }
         }
@@ -196,32 +511,30 @@ Content *ContentTop::yylex_sentence(const string &label, LexBase *lex) {
       if (token.tag == LexBase::LT_ELSE) {
         celse = yylex_block(lex);
       } else {
-        listContent.push_back(token);
+        pending.requeue(token.index);
       }
     }
 
     if (cond && cif) {
-      t = new Content(LexBase::LT_IF, "");
+      t = new (&arena) Content(&arena, LexBase::LT_IF, "");
       t->pc.push_back(cond);
       t->pc.push_back(cif);
-      t->label = label;
+      t->label = arena.intern(label);
       if (celse) {
         t->pc.push_back(celse);
       }
-    } else {
-      if (cond) delete cond;
-      if (cif) delete cif;
-      if (celse) delete celse;
     }
   } else if (token.tag == LexBase::LT_FUNCDEF) {
     if (getContentToken(token, lex) >= 0
       && token.tag == LexBase::LT_TAG) {
-      t = new Content(LexBase::LT_FUNCDEF, token.token);
+      t = new (&arena) Content(&arena, LexBase::LT_FUNCDEF, token.token);
       this->parseFunc = token.token;
       yylex_arg(t, lex);
-      Content *def = yylex_block(lex);
-      t->pc.push_back(def);
-      this->funcs[this->parseFunc] = t;
+      if (!lazy || !skipBody(t)) {
+        Content *def = yylex_block(lex);
+        t->pc.push_back(def);
+      }
+      this->funcs[arena.intern(this->parseFunc).id()] = t;
       this->parseFunc = "";
     }
   } else if (token.tag == LexBase::LT_FOR) {
@@ -230,23 +543,19 @@ Content *ContentTop::yylex_sentence(const string &label, LexBase *lex) {
     Content *cond = yylex_eval(lex);
     Content *b = yylex_block(lex);
     if (cond && b) {
-      t = new Content(LexBase::LT_WHILE, "");
-      t->label = label; 
+      t = new (&arena) Content(&arena, LexBase::LT_WHILE, "");
+      t->label = arena.intern(label); 
       t->pc.push_back(cond);
       t->pc.push_back(b);
-    } else {
-      if (cond) delete cond;
-      if (b) delete b;
     }
   } else if (token.tag == LexBase::LT_BREAK) {
     if (getContentToken(token, lex) >= 0) {
       if (token.tag == LexBase::LT_NL) {
-        t = new Content(LexBase::LT_BREAK, "");
+        t = new (&arena) Content(&arena, LexBase::LT_BREAK, "");
       } else if (token.tag == LexBase::LT_STRING) {
-        t = new Content(LexBase::LT_BREAK, token.token);
+        t = new (&arena) Content(&arena, LexBase::LT_BREAK, token.token);
         if (getContentToken(token, lex) < 0
           || token.tag != LexBase::LT_NL) {
-          delete t;
           return NULL;
         }
       }
@@ -254,13 +563,12 @@ Content *ContentTop::yylex_sentence(const string &label, LexBase *lex) {
   } else if (token.tag == LexBase::LT_CONTINUE) {
     if (getContentToken(token, lex) >= 0) {
       if (token.tag == LexBase::LT_NL) {
-        t = new Content(LexBase::LT_CONTINUE, "");
+        t = new (&arena) Content(&arena, LexBase::LT_CONTINUE, "");
       } else if (token.tag == LexBase::LT_STRING) {
-        t = new Content(LexBase::LT_CONTINUE, token.token);
-        t->arg.push_back(token.token);
+        t = new (&arena) Content(&arena, LexBase::LT_CONTINUE, token.token);
+        t->arg.push_back(arena.intern(token.token));
         if (getContentToken(token, lex) < 0
           || token.tag != LexBase::LT_NL) {
-          delete t;
           return NULL;
         }
       }
@@ -268,14 +576,13 @@ Content *ContentTop::yylex_sentence(const string &label, LexBase *lex) {
   } else if (token.tag == LexBase::LT_RETURN) {
     if (getContentToken(token, lex) >= 0) {
       if (token.tag == LexBase::LT_NL) {
-        t = new Content(LexBase::LT_RETURN, "");
+        t = new (&arena) Content(&arena, LexBase::LT_RETURN, "");
       } else {
-        listContent.push_front(token);
-        t = new Content(LexBase::LT_RETURN, "");
+        pending.unget(token.index);
+        t = new (&arena) Content(&arena, LexBase::LT_RETURN, "");
         t->pc.push_back(yylex_eval(lex));
         if (getContentToken(token, lex) < 0
           || token.tag != LexBase::LT_NL) {
-          delete t;
           return NULL;
         }
       }
@@ -283,15 +590,14 @@ Content *ContentTop::yylex_sentence(const string &label, LexBase *lex) {
   }
 
   if (!t) {
-    listContent.push_back(token);
+    pending.requeue(token.index);
     Content *c = yylex_eval(lex);
-    if (c) c->label = label;
+    if (c) c->label = arena.intern(label);
     if (getContentToken(token, lex) >= 0) {
       if (token.tag == LexBase::LT_NL) {
         t = c;
       } else {
-        listContent.push_back(token);
-        delete c;
+        pending.requeue(token.index);
       }
     }
   }
@@ -304,41 +610,36 @@ Content *ContentTop::yylex_for(const string &label, LexBase *lex) {
 
   if (getContentToken(token, lex) < 0) return NULL;
   if (token.tag != LexBase::LT_OP || token.token != "(") {
-    listContent.push_back(token);
+    pending.requeue(token.index);
     return NULL;
   }
 
   Content *c1 = yylex_eval(lex);
   if (getContentToken(token, lex) < 0) return NULL;
   if (token.tag != LexBase::LT_NL) {
-    listContent.push_back(token);
+    pending.requeue(token.index);
     return NULL;
   }
   Content *c2 = yylex_eval(lex);
   if (getContentToken(token, lex) < 0) return NULL;
   if (token.tag != LexBase::LT_NL) {
-    listContent.push_back(token);
+    pending.requeue(token.index);
     return NULL;
   }
   Content *c3 = yylex_eval(lex);
   if (getContentToken(token, lex) < 0) return NULL;
   if (token.tag != LexBase::LT_OP && token.token != ")") {
-    listContent.push_back(token);
+    pending.requeue(token.index);
     return NULL;
   }
   Content *b = yylex_block(lex);
   if (c1 && c2 && c3 && b) {
-    t = new Content(LexBase::LT_FOR, "");
-    t->label = label;
+    t = new (&arena) Content(&arena, LexBase::LT_FOR, "");
+    t->label = arena.intern(label);
     t->pc.push_back(c1);
     t->pc.push_back(c2);
     t->pc.push_back(c3);
     t->pc.push_back(b);
-  } else {
-    if (c1) delete c1;
-    if (c2) delete c2;
-    if (c3) delete c3;
-    if (b) delete b;
   }
   return t;
 }
@@ -348,21 +649,21 @@ void ContentTop::yylex_arg(Content *c, LexBase *lex) {
 
   if (getContentToken(token, lex) < 0) return;
   if (token.tag != LexBase::LT_OP || token.token != "(") {
-    listContent.push_back(token);
+    pending.requeue(token.index);
     return;
   }
   while (true) {
     if (getContentToken(token, lex) < 0) return;
     if (token.tag == LexBase::LT_VAR) {
-      c->arg.push_back(token.token);
+      c->arg.push_back(arena.intern(token.token));
     } else if (token.tag == LexBase::LT_OP) {
       if (token.token == ")") break;
       if (token.token != ",") {
-        listContent.push_back(token);
+        pending.requeue(token.index);
         break;
       }
     } else {
-      listContent.push_back(token);
+      pending.requeue(token.index);
       break;
     }
   }
@@ -377,17 +678,15 @@ Content *ContentTop::yylex_eval(LexBase *lex) {
     if (getContentToken(token, lex) < 0) return c1;
     if (token.tag == LexBase::LT_OP && token.token == ":") {
       c3 = yylex_eval(lex);
-      t = new Content(LexBase::LT_OP, "?");
+      t = new (&arena) Content(&arena, LexBase::LT_OP, "?");
       t->pc.push_back(c1);
       t->pc.push_back(c2);
       t->pc.push_back(c3);
     }
   } else {
-    listContent.push_back(token);
+    pending.requeue(token.index);
   }
   if (!t) {
-    if (c2) delete c2;
-    if (c3) delete c3;
     t = c1;
   }
   return t;
@@ -399,17 +698,16 @@ Content *ContentTop::yylex_eval3(LexBase *lex) {
 
   while (getContentToken(token, lex) >= 0) {
     if (token.tag != LexBase::LT_OP) {
-      listContent.push_back(token);
+      pending.requeue(token.index);
       return c1;
     }
     if (token.token == "[") {
-cout << "enter []" << endl;
       bool br = false;
-      listContent.push_back(token);
+      pending.requeue(token.index);
       while (getContentToken(token, lex) >= 0) {
         if (token.tag != LexBase::LT_OP || token.token != "[") {
           br = true;
-          listContent.push_back(token);
+          pending.requeue(token.index);
           break;
         }
         Content *c2 = yylex_eval(lex);
@@ -419,36 +717,34 @@ cout << "enter []" << endl;
         }
         if (token.tag != LexBase::LT_OP || token.token != "]") {
           br = true;
-          listContent.push_back(token);
+          pending.requeue(token.index);
           break;
         }
         if (!t) {
-          t = new Content(LexBase::LT_OP, "[");
+          t = new (&arena) Content(&arena, LexBase::LT_OP, "[");
           t->pc.push_back(c1);
         }
         t->pc.push_back(c2);
       }
       if (br) break;
     } else if (token.token == "(") {
-      listContent.push_back(token);
-      t = new Content(LexBase::LT_FUNC, "");
+      pending.requeue(token.index);
+      t = new (&arena) Content(&arena, LexBase::LT_FUNC, "");
       t->pc.push_back(c1);
       if (yylex_func(t, lex) < 0) {
-        delete t;
         return NULL;
       }
       c1 = t;
       t = nullptr;
     } else if (token.token == ".") {
       // a.b().c() 等のケースを配慮する
-cout << "after function/array" << endl;
-      t = new Content(token.tag, token.token);
+      t = new (&arena) Content(&arena, token.tag, token.token);
       t->pc.push_back(c1);
       t->pc.push_back(yylex_mono(lex));
       c1 = t;
       t = nullptr;
     } else {
-      listContent.push_back(token);
+      pending.requeue(token.index);
       break;
     }
   }
@@ -464,7 +760,7 @@ int ContentTop::yylex_func(Content *t, LexBase *lex) {
 
   if (getContentToken(token, lex) < 0) return -1;
   if (token.tag != LexBase::LT_OP || token.token != "(") {
-    listContent.push_back(token);
+    pending.requeue(token.index);
     return -1;
   }
   Content *c = NULL;
@@ -476,14 +772,13 @@ int ContentTop::yylex_func(Content *t, LexBase *lex) {
         break;
       }
       if (token.token != ",") {
-        listContent.push_back(token);
+        pending.requeue(token.index);
         break;
       }
       t->pc.push_back(c);
       c = NULL;
     } else {
-      listContent.push_back(token);
-      delete c;
+      pending.requeue(token.index);
       c = NULL;
       break;
     }
@@ -502,7 +797,7 @@ Content *ContentTop::yylex_evalbody(LexBase *lex) {
   // 終端記号
   if (token.tag == LexBase::LT_OP
    && (token.token == ")" || token.token == "]" || token.token == ",")) {
-    listContent.push_front(token);
+    pending.unget(token.index);
     return NULL;
   }
   
@@ -510,31 +805,31 @@ Content *ContentTop::yylex_evalbody(LexBase *lex) {
   if (token.tag == LexBase::LT_OP && token.token == "+") {
     t = yylex_rhs(lex);
   } else if (token.tag == LexBase::LT_OP && token.token == "-") {
-    t = new Content(LexBase::LT_OP, "-m");
+    t = new (&arena) Content(&arena, LexBase::LT_OP, "-m");
     t->pc.push_back(yylex_rhs(lex));
   } else if (token.tag == LexBase::LT_OP && token.token == "++") {
-    t = new Content(LexBase::LT_OP, "++x");
+    t = new (&arena) Content(&arena, LexBase::LT_OP, "++x");
     t->pc.push_back(yylex_lhs(lex));
   } else if (token.tag == LexBase::LT_OP && token.token == "--") {
-    t = new Content(LexBase::LT_OP, "--x");
+    t = new (&arena) Content(&arena, LexBase::LT_OP, "--x");
     t->pc.push_back(yylex_lhs(lex));
   } else if (token.tag == LexBase::LT_OP && token.token == "!") {
-    t = new Content(LexBase::LT_OP, "!");
+    t = new (&arena) Content(&arena, LexBase::LT_OP, "!");
     t->pc.push_back(yylex_rhs(lex));
   } else if (token.tag == LexBase::LT_OP && token.token == "~") {
-    t = new Content(LexBase::LT_OP, "~");
+    t = new (&arena) Content(&arena, LexBase::LT_OP, "~");
     t->pc.push_back(yylex_rhs(lex));
   } else if (token.tag == LexBase::LT_OP && token.token == "new") {
     t = yylex_new(lex);
   } else if (token.tag == LexBase::LT_THIS || token.tag == LexBase::LT_SUPER || token.tag == LexBase::LT_VAR || token.tag == LexBase::LT_TAG) {
-    listContent.push_back(token);
+    pending.requeue(token.index);
     Content *lhs = yylex_lhs(lex);
     if (getContentToken(token, lex) >= 0 && token.tag == LexBase::LT_OP) {
       if (token.token == "++") {
-        t = new Content(LexBase::LT_OP, "x++");
+        t = new (&arena) Content(&arena, LexBase::LT_OP, "x++");
         t->pc.push_back(lhs);
       } else if (token.token == "--") {
-        t = new Content(LexBase::LT_OP, "x--");
+        t = new (&arena) Content(&arena, LexBase::LT_OP, "x--");
         t->pc.push_back(lhs);
       } else if (token.token == "=" || token.token == "+="
         || token.token == "-=" || token.token == "*="
@@ -542,23 +837,23 @@ Content *ContentTop::yylex_evalbody(LexBase *lex) {
         || token.token == "|=" || token.token == "^="
         || token.token == "<<=" || token.token == ">>=") {
         // 代入演算子
-        t = new Content(LexBase::LT_OP, token.token);
+        t = new (&arena) Content(&arena, LexBase::LT_OP, token.token);
         t->pc.push_back(lhs);
         t->pc.push_back(yylex_eval(lex));
       } else {
-        listContent.push_front(token);
+        pending.unget(token.index);
         t = yylex_rhs2(lhs, lex);
       }
     } else {
       if (lhs) {
-        listContent.push_front(token);
+        pending.unget(token.index);
         t = yylex_rhs2(lhs, lex);
       } else {
-        listContent.push_back(token);
+        pending.requeue(token.index);
       }
     }
   } else {
-    listContent.push_back(token);
+    pending.requeue(token.index);
   }
 
   if (!t) {
@@ -572,7 +867,7 @@ Content *ContentTop::yylex_lhs(LexBase *lex) {
   Content *t = NULL;
 
   if (getContentToken(token, lex) < 0) return NULL;
-  t = new Content(token.tag, token.token);
+  t = new (&arena) Content(&arena, token.tag, token.token);
 
   while (getContentToken(token, lex) >= 0) {
      if (token.tag == LexBase::LT_OP) {
@@ -580,22 +875,21 @@ Content *ContentTop::yylex_lhs(LexBase *lex) {
          t->pc.push_back(yylex_eval(lex));
          if (getContentToken(token, lex) < 0
            || token.tag != LexBase::LT_OP || token.token != "]") {
-           delete t;
            t = NULL;
            break;
          }
        } else if (token.token == ".") {
          if (getContentToken(token, lex) < 0) break;
-         Content *t2 = new Content(LexBase::LT_OP, ".");
+         Content *t2 = new (&arena) Content(&arena, LexBase::LT_OP, ".");
          t2->pc.push_back(t);
-         t2->pc.push_back(new Content(token.tag, token.token));
+         t2->pc.push_back(new (&arena) Content(&arena, token.tag, token.token));
          t = t2;
        } else {
-         listContent.push_back(token);
+         pending.requeue(token.index);
          break;
        }
      } else {
-       listContent.push_back(token);
+       pending.requeue(token.index);
        break;
      }
   }
@@ -612,7 +906,7 @@ Content *ContentTop::yylex_rhs(LexBase *lex) {
       // (c1 + c2).b のようなケースを拾い上げる
       Content *c2 = yylex_mono(lex);
       if (c2) {
-        Content *t = new Content(LexBase::LT_OP, token.token);
+        Content *t = new (&arena) Content(&arena, LexBase::LT_OP, token.token);
         t->pc.push_back(c1);
         t->pc.push_back(c2);
         return t;
@@ -623,15 +917,15 @@ Content *ContentTop::yylex_rhs(LexBase *lex) {
       || token.token == "||") {
       Content *c2 = yylex_eval(lex);
       if (c2) {
-        Content *t = new Content(LexBase::LT_OP, token.token);
+        Content *t = new (&arena) Content(&arena, LexBase::LT_OP, token.token);
         t->pc.push_back(c1);
         t->pc.push_back(c2);
         return t;
       }
     }
-    listContent.push_back(token);
+    pending.requeue(token.index);
   } else {
-    listContent.push_back(token);
+    pending.requeue(token.index);
   }
   return c1;
 }
@@ -650,13 +944,13 @@ Content *ContentTop::yylex_comp(LexBase *lex) {
    || (token.token != "<" && token.token != "<="
      && token.token != ">" && token.token != ">="
      && token.token != "!=" && token.token != "==")) {
-    listContent.push_back(token);
+    pending.requeue(token.index);
     return c1;
   }
   string opname = token.token;
   Content *c2 = yylex_eval(lex);
   if (c2) {
-    Content *t = new Content(LexBase::LT_OP, opname);
+    Content *t = new (&arena) Content(&arena, LexBase::LT_OP, opname);
     t->pc.push_back(c1);
     t->pc.push_back(c2);
     return t;
@@ -673,14 +967,14 @@ Content *ContentTop::yylex_arith(LexBase *lex) {
     if (token.token == "+" || token.token == "-") {
       Content *c2 = yylex_eval(lex);
       if (c2) {
-        Content *t = new Content(LexBase::LT_OP, token.token);
+        Content *t = new (&arena) Content(&arena, LexBase::LT_OP, token.token);
         t->pc.push_back(c1);
         t->pc.push_back(c2);
         return t;
       }
     }
   }
-  listContent.push_back(token);
+  pending.requeue(token.index);
   return c1;
 }
 
@@ -693,14 +987,14 @@ Content *ContentTop::yylex_term(LexBase *lex) {
     if (token.token == "*" || token.token == "/" || token.token == "%") {
       Content *c2 = yylex_eval(lex);
       if (c2) {
-        Content *t = new Content(LexBase::LT_OP, token.token);
+        Content *t = new (&arena) Content(&arena, LexBase::LT_OP, token.token);
         t->pc.push_back(c1);
         t->pc.push_back(c2);
         return t;
       }
     }
   }
-  listContent.push_back(token);
+  pending.requeue(token.index);
   return c1;
 }
 
@@ -715,35 +1009,35 @@ Content *ContentTop::yylex_mono(LexBase *lex) {
   }
   if (getContentToken(token, lex) < 0) return t;
   if (token.tag == LexBase::LT_INT) {
-    t = new Content(token.inum);
+    t = new (&arena) Content(&arena, token.inum);
   } else if (token.tag == LexBase::LT_DNUM) {
-    t = new Content(token.dnum);
+    t = new (&arena) Content(&arena, token.dnum);
   } else if (token.tag == LexBase::LT_STRING) {
-    t = new Content(token.tag, token.token);
+    t = new (&arena) Content(&arena, token.tag, token.token);
   } else if (token.tag == LexBase::LT_VAR || token.tag == LexBase::LT_TAG || token.tag == LexBase::LT_THIS || token.tag == LexBase::LT_SUPER) {
     ContentToken token2;
     if (getContentToken(token2, lex) < 0) {
-      t = new Content(token.tag, token.token);
+      t = new (&arena) Content(&arena, token.tag, token.token);
     } else if (token2.tag != LexBase::LT_OP || token2.token != ".") {
-      listContent.push_back(token2);
-      t = new Content(token.tag, token.token);
+      pending.requeue(token2.index);
+      t = new (&arena) Content(&arena, token.tag, token.token);
     } else {
-      t = new Content(LexBase::LT_OP, ".");
-      t->pc.push_back(new Content(token.tag, token.token));
+      t = new (&arena) Content(&arena, LexBase::LT_OP, ".");
+      t->pc.push_back(new (&arena) Content(&arena, token.tag, token.token));
       t->pc.push_back(yylex_mono(lex));
     }
   } else if (token.tag == LexBase::LT_OP && token.token == "(") {
     t = yylex_eval(lex);
     if (getContentToken(token, lex) >= 0) {
       if (token.tag != LexBase::LT_OP || token.token != ")") {
-        listContent.push_back(token);
+        pending.requeue(token.index);
       }
     }
   } else if (token.tag == LexBase::LT_BEGIN) {
-    t = new Content(LexBase::LT_OP, "array");
+    t = new (&arena) Content(&arena, LexBase::LT_OP, "array");
     while (getContentToken(token, lex) >= 0) {
       if (token.tag == LexBase::LT_BEND) break;
-      listContent.push_back(token);
+      pending.requeue(token.index);
       t->pc.push_back(yylex_eval(lex));
       if (getContentToken(token, lex) < 0) break;
       if (token.tag == LexBase::LT_BEND) break;
@@ -751,11 +1045,11 @@ Content *ContentTop::yylex_mono(LexBase *lex) {
         if (token.token == ",") {
           // do nothing
         } else {
-          listContent.push_back(token);
+          pending.requeue(token.index);
           break;
         }
       } else {
-        listContent.push_back(token);
+        pending.requeue(token.index);
         break;
       }
     }
@@ -777,24 +1071,24 @@ MinosysClassDef *ContentTop::yylex_class(LexBase *lex) {
         if (token.tag == LexBase::LT_TAG) {
           pnames.push_back(token.token);
         } else if (token.tag == LexBase::LT_BEGIN) {
-          listContent.push_back(token);
+          pending.requeue(token.index);
           break;
         } else if (token.tag != LexBase::LT_OP || token.token != ".") {
-          listContent.push_back(token);
+          pending.requeue(token.index);
           return NULL;
         }
       }
     } else {
-      listContent.push_back(token);
+      pending.requeue(token.index);
       return NULL;
     }
   } else if (token.tag == LexBase::LT_BEGIN) {
-    listContent.push_back(token);
+    pending.requeue(token.index);
   } else {
-    listContent.push_back(token);
+    pending.requeue(token.index);
     return NULL;
   }
-  def = new MinosysClassDef();
+  def = new (arena.alloc(sizeof(MinosysClassDef))) MinosysClassDef();
   if (!pnames.empty()) {
     def->parentClass = pnames;
   }
@@ -816,14 +1110,17 @@ MinosysClassDef *ContentTop::yylex_class(LexBase *lex) {
         if (getContentToken(token, lex) < 0
           || token.tag != LexBase::LT_TAG) goto loop_out;
         string memname = token.token;
-        Content *c = new Content(LexBase::LT_FUNCDEF, memname);
+        Content *c = new (&arena) Content(&arena, LexBase::LT_FUNCDEF, memname);
         yylex_arg(c, lex);
+        if (lazy && skipBody(c)) {
+          def->members[memname] = c;
+          continue;
+        }
         Content *b = yylex_block(lex);
         if (b) {
           c->pc.push_back(b);
           def->members[memname] = c;
         } else {
-          delete c;
           goto loop_out;
         }
       } else {
@@ -832,32 +1129,31 @@ MinosysClassDef *ContentTop::yylex_class(LexBase *lex) {
     }
   } while(0);
  loop_out:
-  delete def;
+  def->~MinosysClassDef();
   return NULL;
 }
 
 Content *ContentTop::yylex_new(LexBase *lex) {
   ContentToken token;
-  Content *t = new Content(LexBase::LT_OP, "new");
+  Content *t = new (&arena) Content(&arena, LexBase::LT_OP, "new");
 
   if (getContentToken(token, lex) >= 0) {
     if (token.tag == LexBase::LT_TAG) {
-      t->arg.push_back(token.token);
+      t->arg.push_back(arena.intern(token.token));
     }
     while (getContentToken(token, lex) >= 0) {
       if (token.tag == LexBase::LT_NL) {
-        listContent.push_back(token);
+        pending.requeue(token.index);
         break;
       }
       if (token.tag == LexBase::LT_OP) {
         if (token.token == "."
          && getContentToken(token, lex) >= 0
          && token.tag == LexBase::LT_TAG) {
-           t->arg.push_back(token.token);
+           t->arg.push_back(arena.intern(token.token));
         } else if (token.token == "(") {
-          listContent.push_back(token);
+          pending.requeue(token.index);
           if (yylex_func(t, lex) < 0) {
-            delete t;
             t = NULL;
           }
           break;
@@ -869,12 +1165,13 @@ Content *ContentTop::yylex_new(LexBase *lex) {
 }
 
 string ContentTop::toString() {
-  Content *t = this->top;
   string si = toStringImports();
   string sd = toStringDefines();
   string sc;
-  if (t) {
-    sc = t->toString();
+  FlatTree flat;
+  flatten(flat);
+  for (auto p = funcs.begin(); p != funcs.end(); ++p) {
+    sc += flat.toString(flat.index(p->second));
   }
   string s = si + sd + sc + "\n";
   return s;
@@ -990,3 +1287,59 @@ string Content::toStringInt() {
   return s;
 }
 
+
+// Content::toString と同じ形式で出力する
+string FlatTree::toString(uint32_t i) const {
+  string s;
+  for (; i; i = nodes[i].next) {
+    s += toStringInt(i);
+  }
+  return s;
+}
+
+string FlatTree::toStringInt(uint32_t i) const {
+  const FlatNode &f = nodes[i];
+  string s;
+
+  IString lb = label(i);
+  if (!lb.empty()) {
+    s += lb + ":";
+  }
+  s += "[";
+  switch (f.tag) {
+  case LexBase::LT_VAR: s += string("VAR:") + str(i); break;
+  case LexBase::LT_TAG: s += string("TAG:") + str(i); break;
+  case LexBase::LT_OP: s += string("OP:") + str(i); break;
+  case LexBase::LT_FUNCDEF: s += string("FUNCDEF:") + str(i); break;
+  case LexBase::LT_FUNC: s += string("FUNC:") + str(i); break;
+  case LexBase::LT_BEGIN: s += string("BEGIN:"); break;
+  case LexBase::LT_NL: s += string("NL"); break;
+  case LexBase::LT_STRING: s += string("\"") + str(i) + "\""; break;
+  case LexBase::LT_INT: s += to_string((int)f.value); break;
+  case LexBase::LT_DNUM: s += to_string(dnums[f.value]); break;
+  case LexBase::LT_IF: s+= "if"; break;
+  case LexBase::LT_FOR: s += "for"; break;
+  case LexBase::LT_WHILE: s += "while"; break;
+  case LexBase::LT_CONTINUE: s += string("continue:") + str(i); break;
+  case LexBase::LT_BREAK: s += string("break:") + str(i); break;
+  case LexBase::LT_NEW: s += "new"; break;
+  case LexBase::LT_RETURN: s += "return"; break;
+  default: s += string("???:") + str(i);
+  }
+  s += "]";
+  auto pa = args.find(i);
+  if (pa != args.end()) {
+    s += "(";
+    for (auto p = pa->second.begin(); p != pa->second.end(); ++p) {
+      if (p != pa->second.begin()) s += ",";
+      s += *p;
+    }
+    s += ")";
+  }
+  for (int k = 0; k < f.nchild; ++k) {
+    s += "[";
+    s += toString(child(i, k));
+    s += "]";
+  }
+  return s;
+}
@@ -3,85 +3,307 @@
 
 #include "lex.h"
 #include <vector>
-#include <list>
 #include <unordered_map>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include "exception.h"
 
 namespace minosys {
 
+// LT_OP ノードの演算子
+// 構文解析時に決定し、評価時は文字列ではなくこの値で分岐する
+enum OpType {
+  OT_NONE = 0,
+  OT_DOT,		// .
+  OT_3TERM,		// ?
+  OT_ASSIGN,		// =
+  OT_ASSIGNPLUS,	// +=
+  OT_ASSIGNMINUS,	// -=
+  OT_ASSIGNMULTIPLY,	// *=
+  OT_ASSIGNDIV,		// /=
+  OT_ASSIGNMOD,		// %=
+  OT_ASSIGNAND,		// &=
+  OT_ASSIGNOR,		// |=
+  OT_ASSIGNXOR,		// ^=
+  OT_ASSIGNLSH,		// <<=
+  OT_ASSIGNRSH,		// >>=
+  OT_MONONOT,		// !
+  OT_NEGATE,		// ~
+  OT_MONOMINUS,		// -m
+  OT_PREINCR,		// ++x
+  OT_POSTINCR,		// x++
+  OT_PREDECR,		// --x
+  OT_POSTDECR,		// x--
+  OT_LT,		// <
+  OT_LTEQ,		// <=
+  OT_GT,		// >
+  OT_GTEQ,		// >=
+  OT_NEQ,		// !=
+  OT_EQ,		// ==
+  OT_PLUS,		// +
+  OT_MINUS,		// -
+  OT_MULTIPLY,		// *
+  OT_DIV,		// /
+  OT_MOD,		// %
+  OT_AND,		// &
+  OT_OR,		// |
+  OT_XOR,		// ^
+  OT_LOGAND,		// &&
+  OT_LOGOR,		// ||
+  OT_LSH,		// <<
+  OT_RSH,		// >>
+  OT_LEFTARRAY,		// [
+  OT_ARRAY,		// { ... }
+  OT_NEW,		// new
+  OT_MAX
+};
+OpType toOpType(const std::string &op);
+
 class Content;
+
+// 識別子の番号; SymbolTable が払い出す
+// 0 は空文字列を表す
+typedef uint32_t Symbol;
+
+struct SymbolEntry {
+  const std::string *str;	// SymbolTable::index のキー
+  Symbol id;
+};
+
+// intern された文字列への参照
+// 同じ SymbolTable 内では同じ内容の文字列は同じ実体を指す
+class IString {
+ public:
+  IString() : e(&emptyEntry()) {}
+  explicit IString(const SymbolEntry *e) : e(e) {}
+  operator const std::string &() const { return *e->str; }
+  const std::string &str() const { return *e->str; }
+  Symbol id() const { return e->id; }
+  const char *c_str() const { return e->str->c_str(); }
+  size_t size() const { return e->str->size(); }
+  bool empty() const { return e->str->empty(); }
+  bool operator == (const IString &o) const { return e == o.e || *e->str == *o.e->str; }
+  bool operator != (const IString &o) const { return !(*this == o); }
+  bool operator == (const std::string &o) const { return *e->str == o; }
+  bool operator != (const std::string &o) const { return *e->str != o; }
+  bool operator == (const char *o) const { return *e->str == o; }
+  bool operator != (const char *o) const { return *e->str != o; }
+
+ private:
+  const SymbolEntry *e;
+  static const SymbolEntry &emptyEntry() {
+    static const std::string s;
+    static const SymbolEntry empty = { &s, 0 };
+    return empty;
+  }
+};
+
+// 識別子と文字列定数の表
+// Engine がひとつ持ち、全パッケージの構文木で共有する; 番号は Engine 内で一意
+class SymbolTable {
+ public:
+  SymbolTable();
+  IString intern(const std::string &s);
+  Symbol symbol(const std::string &s) { return intern(s).id(); }
+  Symbol find(const std::string &s) const;	// 未登録なら 0
+  const std::string &name(Symbol id) const;
+  size_t size() const;
+
+ private:
+  mutable std::mutex lock;	// パッケージは複数のスレッドで並行して構文解析される
+  std::unordered_map<std::string, SymbolEntry> index;
+  std::vector<const SymbolEntry *> entries;	// 番号順
+  SymbolTable(const SymbolTable &);
+  SymbolTable &operator = (const SymbolTable &);
+};
+
+inline std::string operator + (const std::string &a, const IString &b) { return a + b.str(); }
+inline std::string operator + (const char *a, const IString &b) { return a + b.str(); }
+inline std::string operator + (const IString &a, const std::string &b) { return a.str() + b; }
+inline std::string operator + (const IString &a, const char *b) { return a.str() + b; }
+
+// パッケージ単位の bump allocator
+// 構文木はすべてここから確保し、個別には解放しない
+class Arena {
+ public:
+  size_t nodes;		// 確保した Content の数
+  size_t bytes;		// 確保したバイト数
+  SymbolTable *symbols;	// intern() の登録先
+  Arena(SymbolTable *symbols);
+  ~Arena();
+  void *alloc(size_t size);
+  IString intern(const std::string &s);
+
+ private:
+  enum { CHUNKSIZE = 64 * 1024 };
+  std::vector<char *> chunks;
+  char *cur;
+  size_t left;
+  SymbolTable *owned;	// 共有する表がない場合は自前で持つ
+  Arena(const Arena &);
+  Arena &operator = (const Arena &);
+};
+
+// Arena から確保する STL allocator; 解放はしない
+template<class T> struct ArenaAllocator {
+  typedef T value_type;
+  Arena *arena;
+  ArenaAllocator(Arena *a) : arena(a) {}
+  template<class U> ArenaAllocator(const ArenaAllocator<U> &a) : arena(a.arena) {}
+  T *allocate(size_t n) { return (T *)arena->alloc(n * sizeof(T)); }
+  void deallocate(T *, size_t) {}
+  template<class U> bool operator == (const ArenaAllocator<U> &a) const { return arena == a.arena; }
+  template<class U> bool operator != (const ArenaAllocator<U> &a) const { return arena != a.arena; }
+};
+
 struct MinosysClassDef {
   std::vector<std::string> parentClass;
   std::vector<std::string> vars;
   std::unordered_map<std::string, Content *> members;
-  ~MinosysClassDef();
   std::string toString(const std::string &name);
   std::string toStringParentClass();
 };
 
+// 構文木のノード; ContentTop::arena に置かれ、デストラクタは呼ばれない
 class Content {
  public:
   LexBase::LexTag tag;
-  std::string op;
-  std::string label;
+  OpType opcode;
+  int slot;	// LT_VAR: ローカル変数スロット (-1: 動的検索)
+  int gslot;	// LT_VAR: グローバル変数スロット (-1: 未割り当て)
+  IString op;
+  IString label;
   int inum;
   double dnum;
-  std::vector<std::string> arg;
-  std::vector<Content *>pc;
+  std::vector<IString, ArenaAllocator<IString> > arg;
+  std::vector<Content *, ArenaAllocator<Content *> > pc;
 
   Content *next, *last;
 
-  Content() : tag(LexBase::LT_NULL), next(NULL), last(this) {}
-  Content(LexBase::LexTag t, std::string o) : tag(t), op(o) {
+  Content(Arena *a, LexBase::LexTag t, const std::string &o) : tag(t), slot(-1), gslot(-1), op(a->intern(o)), arg(a), pc(a) {
+    opcode = (t == LexBase::LT_OP) ? toOpType(op) : OT_NONE;
     next = NULL;
     last = this;
   }
-  Content(int itoken) : tag(LexBase::LT_INT), inum(itoken) {
+  Content(Arena *a, int itoken) : tag(LexBase::LT_INT), opcode(OT_NONE), slot(-1), gslot(-1), inum(itoken), arg(a), pc(a) {
     next = NULL;
     last = this;
   }
-  Content(double dtoken) : tag(LexBase::LT_DNUM), dnum(dtoken) {
+  Content(Arena *a, double dtoken) : tag(LexBase::LT_DNUM), opcode(OT_NONE), slot(-1), gslot(-1), dnum(dtoken), arg(a), pc(a) {
     next = NULL;
     last = this;
   }
-  ~Content();
+  static void *operator new (size_t size, Arena *a) {
+    ++a->nodes;
+    return a->alloc(size);
+  }
+  static void operator delete (void *, Arena *) {}
   std::string toString();
   std::string toStringInt();
+
+ private:
+  static void operator delete (void *) {}
+};
+
+// 平坦化した構文木のノード
+// 子は連続した添字に並び、文の列は next でつながる; 添字 0 は「なし」を表す
+struct FlatNode {
+  uint8_t tag;		// LexBase::LexTag; 空の子は LT_NULL
+  uint8_t opcode;	// OpType
+  uint16_t nchild;	// 子の数
+  uint32_t child;	// 最初の子の添字
+  uint32_t next;	// 次の文の添字
+  uint32_t value;	// LT_INT: 値, LT_DNUM: dnums の添字, その他: strs の添字
 };
 
+// Content 木を 1 つの配列に並べ直したもの
+// bytecode compiler などがたどる間だけ作成し、Content 木は残したまま使い終われば捨てる
+class FlatTree {
+ public:
+  std::vector<FlatNode> nodes;
+  std::vector<Content *> origin;	// ノードの元になった Content
+  std::vector<IString> strs;
+  std::vector<double> dnums;
+  std::unordered_map<uint32_t, IString> labels;
+  std::unordered_map<uint32_t, std::vector<IString> > args;
+  FlatTree() : nodes(1), origin(1) {}
+  uint32_t add(Content *c);
+  uint32_t index(Content *c) const;
+  const FlatNode &operator [] (uint32_t i) const { return nodes[i]; }
+  uint32_t child(uint32_t i, int k) const { return nodes[i].child + k; }
+  const IString &str(uint32_t i) const { return strs[nodes[i].value]; }
+  IString label(uint32_t i) const;
+  std::string toString(uint32_t i) const;
+
+ private:
+  std::unordered_map<Content *, uint32_t> roots;
+  std::unordered_map<const std::string *, uint32_t> strindex;
+  uint32_t alloc(Content *c);
+  void fill(uint32_t i, Content *c);
+  void fillChain(uint32_t i, Content *c);
+  uint32_t addString(const IString &s);
+  std::string toStringInt(uint32_t i) const;
+};
+
+// パーサーが扱うトークン; 文字列は TokenBuffer を参照する
 struct ContentToken {
   LexBase::LexTag tag;
-  std::string token;
+  TokenText token;
   int inum;
   double dnum;
-  void init() {
-    token.clear();
-    inum = 0;
-    dnum = 0.0;
-  }
-  ContentToken() {
-    init();
+  uint32_t index;	// TokenBuffer 内の添字
+  ContentToken() : tag(LexBase::LT_NULL), inum(0), dnum(0.0), index(0) {}
+  ContentToken(const TokenBuffer &b, uint32_t i) : tag((LexBase::LexTag)b[i].tag), inum(0), dnum(0.0), index(i) {
+    if (tag == LexBase::LT_INT) {
+      this->inum = b[i].inum;
+    } else if (tag == LexBase::LT_DNUM) {
+      this->dnum = b[i].dnum;
+    } else {
+      this->token = b.text(i);
+    }
   }
-  ContentToken(LexBase::LexTag t) {
-    init();
-    this->tag = t;
+};
+
+// 読み戻したトークンの添字を保持するリングバッファ
+// パーサーは読んだトークンを 1 個ずつ戻すので、通常は 1 個、失敗して呼び出し元へ戻る途中で重なっても数個に収まる
+// 収まらなければそれ以降を読めなくし、構文解析の失敗として扱う (overflowed)
+class TokenRing {
+ public:
+  enum { CAPACITY = 8, MASK = CAPACITY - 1 };
+  TokenRing() : head(0), count(0), overflow(false) {}
+  bool empty() const { return count == 0; }
+  bool overflowed() const { return overflow; }
+  uint32_t size() const { return count; }
+  uint32_t operator [] (uint32_t n) const { return buf[(head + n) & MASK]; }
+  uint32_t pop() {
+    uint32_t i = buf[head];
+    head = (head + 1) & MASK;
+    --count;
+    return i;
   }
-  ContentToken(int itoken) : ContentToken(LexBase::LT_INT) {
-    this->inum = itoken;
+  // 先頭に戻す; 次に読まれる
+  void unget(uint32_t i) {
+    if (full()) return;
+    head = (head - 1) & MASK;
+    buf[head] = i;
+    ++count;
   }
-  ContentToken(double dtoken) : ContentToken(LexBase::LT_DNUM) {
-    this->dnum = dtoken;
+  // 末尾に戻す; すでに読み戻したトークンの後に読まれる
+  void requeue(uint32_t i) {
+    if (full()) return;
+    buf[(head + count) & MASK] = i;
+    ++count;
   }
-  ContentToken(LexBase::LexTag t, LexBase *c) {
-    init();
-    this->tag = t;
-    if (t == LexBase::LT_INT) {
-      this->inum = c->itoken;
-    } else if (t == LexBase::LT_DNUM) {
-      this->dnum = c->dtoken;
-    } else {
-      this->token = c->token;
-    }
+  void clear() { head = count = 0; }
+
+ private:
+  uint32_t buf[CAPACITY];
+  uint32_t head, count;
+  bool overflow;	// clear() では戻さない
+  bool full() {
+    if (count == CAPACITY) overflow = true;
+    return overflow;
   }
 };
 
@@ -92,25 +314,47 @@ struct Label {
   Label(int n, Content *c) : nest(n), content(c) {}
 };
 
+// ソースファイルの識別情報; 事前コンパイル済みキャッシュの検証に使う
+struct SourceStamp {
+  uint64_t size;
+  int64_t mtime;
+  uint64_t hash;	// 内容の FNV-1a
+  bool read(const std::string &path);
+};
+
 class ContentTop {
  public:
   Content *top;
   Content *last;
   int nest;
-  std::list<ContentToken> listContent;
+  TokenRing pending;	// 読み戻したトークン
+  const TokenBuffer *tokens;	// 構文解析中のトークン列
+  uint32_t tokpos;
   std::unordered_map<std::string, std::unordered_map<std::string, Label> > labels;
   Content *savedLHS;
   std::string parseFunc;
   std::vector<std::string> imports;
-  std::unordered_map<std::string, Content *> funcs;
+  std::unordered_map<Symbol, Content *> funcs;	// 関数名の Symbol から LT_FUNCDEF
   std::unordered_map<std::string, MinosysClassDef *> defines;
-  ContentTop() : top(NULL), last(NULL), savedLHS(NULL), nest(0) {}
+  Arena arena;
+  bool lazy;	// 関数本体の構文解析を最初の呼び出しまで遅らせる
+  ContentTop(SymbolTable *symbols = NULL) : top(NULL), last(NULL), savedLHS(NULL), nest(0), tokens(NULL), tokpos(0), arena(symbols), lazy(false) {}
+  ~ContentTop();
   Content *yylex(LexBase *lex);
+  Content *yylex(std::unique_ptr<LexBase> lex);
+  void flatten(FlatTree &flat) const;
+  bool parsed(Content *def) const { return lazyBodies.find(def) == lazyBodies.end(); }
+  Content *body(Content *def);
+  bool saveCache(const std::string &path, const SourceStamp &st) const;
+  bool loadCache(const std::string &path, const SourceStamp &st);
+  bool encodeCache(std::string &buf, const SourceStamp &st) const;
+  bool decodeCache(const char *data, size_t size, const SourceStamp &st);
   std::string toStringImports();
   std::string toStringDefines();
   std::string toString();
 
  private:
+  Content *yylex_list(LexBase *lex);
   Content *yylex_block(LexBase *lex);
   Content *yylex_sentence(const std::string &label, LexBase *lex);
   void yylex_arg(Content *c, LexBase *lex);
@@ -129,7 +373,18 @@ class ContentTop {
   Content *yylex_new(LexBase *lex);
   MinosysClassDef *yylex_class(LexBase *lex);
   int getContentToken(ContentToken &t, LexBase *lex);
+  int peekContentToken(ContentToken &t, uint32_t n);
   void setLabel(Content *t, const std::string &label);
+
+  // 構文解析を遅らせた関数本体; { から対応する } までのトークンを写して持つ
+  struct LazyBody {
+    TokenBuffer tokens;	// 末尾は LT_NULL; src は source を指す
+    int nest;
+    IString func;	// parseFunc
+  };
+  std::unordered_map<Content *, LazyBody> lazyBodies;	// LT_FUNCDEF から本体
+  std::unique_ptr<LexBase> source;	// lazyBodies のトークンが指すソース; 全部解析すれば閉じる
+  bool skipBody(Content *def);
 };
 
 } // minosys
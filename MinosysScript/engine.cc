@@ -1,8 +1,21 @@
 #include "engine.h"
+#include "bytecode.h"
 #include "minosysscr_api.h"
+#include <cstddef>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <algorithm>
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <unordered_set>
 #include <iostream>
 
 using namespace std;
@@ -13,7 +26,9 @@ bool VarKey::operator == (const VarKey &k) const {
   switch (vtype) {
   case VT_INT: return u.inum == k.u.inum;
   case VT_DNUM: return u.dnum == k.u.dnum;
-  case VT_STRING: return *u.str == *k.u.str;
+  case VT_STRING:
+    if (isLong() && k.isLong() && u.lstr == k.u.lstr) return true;
+    return length() == k.length() && memcmp(data(), k.data(), length()) == 0;
   }
   return false;
 }
@@ -31,118 +46,354 @@ string VarKey::toString() const {
     return to_string(this->u.dnum);
 
   case VT_STRING:
-    return *this->u.str;
+    return std::string(data(), length());
   }
   return "";
 }
 
-Var::Var(const Var &v) : vtype(v.vtype) {
+// prefix の後ろに p を連結した実体; prefix の参照を 1 つ持つ
+VarString::VarString(VarString *prefix, const char *p, size_t n) : refcount(1), s(p, n) {
+  prefix->compact();
+  ++prefix->refcount;
+  this->plen = prefix->size();
+  this->prefix = prefix;
+}
+
+// 連結の鎖をたどって 1 本の文字列にする
+void VarString::flatten() {
+  vector<VarString *> chain;
+  for (VarString *p = prefix; p; p = p->prefix) {
+    chain.push_back(p);
+  }
+  string r;
+  r.reserve(size());
+  for (auto p = chain.rbegin(); p != chain.rend(); ++p) {
+    r.append((*p)->s);
+  }
+  r.append(s);
+  s.swap(r);
+  release(prefix);
+  prefix = NULL;
+  plen = 0;
+}
+
+// 他から参照されていない prefix を自分に取り込む
+// prefix の s の後ろに自分の s を足して入れ替えるので、
+// 短い文字列を繰り返し連結しても長い側は複製しない
+void VarString::compact() {
+  while (prefix && prefix->refcount == 1) {
+    VarString *p = prefix;
+    p->s.append(s);
+    s.swap(p->s);
+    plen = p->plen;
+    prefix = p->prefix;
+    p->prefix = NULL;
+    delete p;
+  }
+}
+
+void VarString::release(VarString *p) {
+  while (p && --p->refcount == 0) {
+    VarString *next = p->prefix;
+    p->prefix = NULL;
+    delete p;
+    p = next;
+  }
+}
+
+KeyString *KeyString::create(const char *s, size_t len, size_t hash) {
+  KeyString *k = (KeyString *)::operator new(offsetof(KeyString, data) + len);
+  k->refcount = 1;
+  k->len = (uint32_t)len;
+  k->hash = hash;
+  memcpy(k->data, s, len);
+  return k;
+}
+
+const VarPtr *VarArray::findHash(const VarKey &key) const {
+  auto p = hash.find(key);
+  return p != hash.end() ? &p->second : NULL;
+}
+
+// 文字列の添字は VarKey を作らずに探す
+const VarPtr *VarArray::find(const string &key) const {
+  auto p = hash.find(key);
+  return p != hash.end() ? &p->second : NULL;
+}
+
+VarPtr &VarArray::at(const string &key) {
+  auto p = hash.emplace(key);
+  if (p.second) p.first->second = newVar();
+  return p.first->second;
+}
+
+VarPtr &VarArray::atHash(const VarKey &key) {
+  auto p = hash.emplace(key);
+  if (p.second) p.first->second = newVar();
+  return p.first->second;
+}
+
+// list にない整数の添字 i の要素を作成する
+VarPtr &VarArray::insert(int i) {
+  if (i < 0 || (size_t)i != list.size()) {
+    return atHash(VarKey(i));
+  }
+  list.push_back(newVar());
+  // 続きの添字が hash にあれば list へ移す
+  while (!hash.empty()) {
+    auto p = hash.find(VarKey((int)list.size()));
+    if (p == hash.end()) break;
+    list.push_back(std::move(p->second));
+    hash.erase(p);
+  }
+  return list[i];
+}
+
+Var::Var(const Var &v) : vtype(VT_NULL), constant(false), refcount(0), pointer(NULL) {
+  copyFrom(v);
+}
+
+Var::Var(Instance *i) : vtype(VT_INST), constant(false), refcount(0), pinst(i) {
+  if (i) ++i->refcount;
+}
+
+thread_local size_t VarPool::allocs = 0;
+thread_local size_t VarPool::heapallocs = 0;
+thread_local VarPool::Block *VarPool::freelist = NULL;
+
+void *VarPool::alloc(size_t size) {
+  ++allocs;
+  if (size > BLOCKSIZE) {
+    ++heapallocs;
+    return ::operator new(size);
+  }
+  if (!freelist) {
+    // CHUNK 個のブロックをまとめて確保する; 確保したブロックは解放しない
+    ++heapallocs;
+    char *chunk = (char *)::operator new(BLOCKSIZE * CHUNK);
+    for (int i = 0; i < CHUNK; ++i) {
+      Block *b = (Block *)(chunk + i * BLOCKSIZE);
+      b->next = freelist;
+      freelist = b;
+    }
+  }
+  Block *b = freelist;
+  freelist = b->next;
+  return b;
+}
+
+void VarPool::free(void *p, size_t size) {
+  if (size > BLOCKSIZE) {
+    ::operator delete(p);
+    return;
+  }
+  Block *b = (Block *)p;
+  b->next = freelist;
+  freelist = b;
+}
+
+Var & Var::operator = (const Var &v) {
+  if (this != &v) {
+    release();
+    copyFrom(v);
+  }
+  return *this;
+}
+
+// 実体を複製する; release() 済みであること
+void Var::copyFrom(const Var &v) {
+  vtype = v.vtype;
   switch (vtype) {
   case VT_NULL:
+  case VT_POINTER:
+    pointer = v.pointer;
     break;
 
   case VT_INT:
-    this->inum = v.inum;
+    inum = v.inum;
     break;
 
   case VT_DNUM:
-    this->dnum = v.dnum;
+    dnum = v.dnum;
     break;
 
   case VT_STRING:
-    this->str = v.str;
+    pstr = v.pstr;
+    ++pstr->refcount;
     break;
 
   case VT_INST:
-    this->inst = v.inst;
-    break;
-
-  case VT_POINTER:
-    this->pointer = v.pointer;
+    pinst = v.pinst;
+    if (pinst) ++pinst->refcount;
     break;
 
   case VT_ARRAY:
-    this->arrayhash = v.arrayhash;
+    parray = v.parray;
+    ++parray->refcount;
     break;
 
   case VT_FUNC:
-    this->func = v.func;
+    fn = v.fn;
     break;
 
   case VT_MEMBER:
-    this->member = v.member;
+    pmember = new MemberPair(*v.pmember);
     break;
   }
 }
 
-Var & Var::operator = (const Var &v) {
-  vtype = v.vtype;
+// 実体を解放して null にする
+void Var::release() {
   switch (vtype) {
-  case VT_NULL:
-    this->inum = 0;
+  case VT_STRING:
+    VarString::release(pstr);
     break;
 
-  case VT_INT:
-    this->inum = v.inum;
+  case VT_INST:
+    if (pinst && --pinst->refcount == 0) delete pinst;
     break;
 
-  case VT_DNUM:
-    this->dnum = v.dnum;
+  case VT_ARRAY:
+    if (--parray->refcount == 0) delete parray;
     break;
 
+  case VT_MEMBER:
+    delete pmember;
+    break;
+  }
+  vtype = VT_NULL;
+  pointer = NULL;
+}
+
+void Var::settype(VTYPE t) {
+  if (t == vtype) return;
+  switch (t) {
+  case VT_INT:
+  case VT_DNUM:
+    if (vtype == VT_INT || vtype == VT_DNUM) {
+      // 数値同士の変更は値を保持する
+      vtype = t;
+      return;
+    }
+    break;
+  }
+  release();
+  vtype = t;
+  switch (t) {
   case VT_STRING:
-    this->str = v.str;
+    pstr = new VarString(string());
     break;
 
   case VT_INST:
-    this->inst = v.inst;
+    pinst = NULL;
     break;
 
-  case VT_POINTER:
-    this->pointer = v.pointer;
+  case VT_ARRAY:
+    parray = new VarArray();
+    ++parray->refcount;
+    break;
+
+  case VT_FUNC:
+    fn.package = fn.name = 0;
+    break;
+
+  case VT_MEMBER:
+    pmember = new MemberPair();
+    break;
+  }
+}
+
+// 共有している文字列・配列の実体を複製して自分だけのものにする
+void Var::unshare() {
+  switch (vtype) {
+  case VT_STRING:
+    {
+      VarString *old = pstr;
+      pstr = new VarString(old->str());
+      --old->refcount;
+    }
     break;
 
   case VT_ARRAY:
-    this->arrayhash = v.arrayhash;
+    --parray->refcount;
+    parray = new VarArray(*parray);
+    ++parray->refcount;
     break;
   }
 }
 
-shared_ptr<Var> Var::clone() {
+void Var::setString(const string &s) {
+  if (vtype == VT_STRING && pstr->refcount == 1 && !pstr->prefix) {
+    pstr->s = s;
+    return;
+  }
+  release();
+  vtype = VT_STRING;
+  pstr = new VarString(s);
+}
+
+void Var::appendStr(const char *p, size_t n) {
+  if (pstr->refcount == 1) {
+    // 自分だけの実体なら prefix があっても s の後ろに足せばよい
+    pstr->s.append(p, n);
+    return;
+  }
+  if (pstr->size() < VarString::ROPEMIN) {
+    mutableStr().append(p, n);
+    return;
+  }
+  VarString *ps = new VarString(pstr, p, n);
+  --pstr->refcount;
+  pstr = ps;
+}
+
+VarPtr Var::concat(const char *p, size_t n) const {
+  if (pstr->size() < VarString::ROPEMIN) {
+    string s;
+    s.reserve(pstr->size() + n);
+    s.append(str()).append(p, n);
+    return newVar(s);
+  }
+  VarPtr v = newVar();
+  v->vtype = VT_STRING;
+  v->pstr = new VarString(pstr, p, n);
+  return v;
+}
+
+VarPtr Var::clone() {
   switch (vtype) {
   case VT_NULL:
-    return make_shared<Var>();
+    return newVar();
 
   case VT_INT:
-    return make_shared<Var>(inum);
+    return newVar(inum);
 
   case VT_DNUM:
-    return make_shared<Var>(dnum);
+    return newVar(dnum);
 
   case VT_STRING:
-    return make_shared<Var>(str);
+  case VT_ARRAY:
+    // 実体は書き込むまで共有する
+    return newVar(*this);
 
   case VT_INST:
-    return make_shared<Var>(inst);
+    return newVar(inst());
 
   case VT_POINTER:
     {
-      shared_ptr<Var> v = make_shared<Var>();
-      v->vtype = VT_POINTER;
+      VarPtr v = newVar();
+      v->settype(VT_POINTER);
       v->pointer = pointer;
       return v;
     }
 
-  case VT_ARRAY:
-    return make_shared<Var>(arrayhash);
-
   case VT_FUNC:
-    return make_shared<Var>(func);
+    return newVar(func());
 
   case VT_MEMBER:
-    return make_shared<Var>(member);
+    return newVar(member());
   }
-  return make_shared<Var>();
+  return newVar();
 }
 
 bool Var::isTrue() const {
@@ -157,22 +408,22 @@ bool Var::isTrue() const {
     return dnum != 0.0;
 
   case VT_STRING:
-    return str != "";
+    return str() != "";
 
   case VT_INST:
-    return inst.get() != NULL;
+    return inst() != NULL;
 
   case VT_ARRAY:
-    return !arrayhash.empty();
+    return !array().empty();
 
   case VT_POINTER:
     return pointer != NULL;
 
   case VT_FUNC:
-    return func.first.empty() && func.second.empty();
+    return func().package == 0 && func().name == 0;
 
   case VT_MEMBER:
-    return !member.first && member.second.empty();
+    return !member().first && member().second == 0;
 
   default:
     return false;
@@ -206,13 +457,13 @@ bool Var::operator == (const Var &v) const {
 
   case VT_STRING:
     if (v.vtype == VT_STRING) {
-      return this->str == v.str;
+      return this->str() == v.str();
     }
     break;
 
   case VT_INST:
     if (v.vtype == VT_INST) {
-      return this->inst == v.inst;
+      return this->inst() == v.inst();
     }
     break;
 
@@ -224,19 +475,19 @@ bool Var::operator == (const Var &v) const {
 
   case VT_ARRAY:
     if (v.vtype == VT_ARRAY) {
-      return this->arrayhash == v.arrayhash;
+      return this->array() == v.array();
     }
     break;
 
   case VT_FUNC:
     if (v.vtype == VT_FUNC) {
-      return this->func == v.func;
+      return this->func() == v.func();
     }
     break;
 
   case VT_MEMBER:
     if (v.vtype == VT_MEMBER) {
-      return this->member == v.member;
+      return this->member() == v.member();
     }
     break;
   }
@@ -244,52 +495,61 @@ bool Var::operator == (const Var &v) const {
   return false;
 }
 
-Var::~Var() {
-}
 
-
-#define OPMAP(cc,name) opmap[cc] = [](PackageMinosys *p, Content *c){ return p->eval_op_##name(c); }
-#define BUILTINMAP(map,cc,name) map[cc] = [](PackageMinosys *p, const vector<shared_ptr<Var> > &args) { return p->func##name (args); }
+#define BUILTINMAP(map,cc,name) map[eng->symbols.symbol(cc)] = [](PackageMinosys *p, const vector<VarPtr> &args) { return p->func##name (args); }
 #undef BUILTIN
-#define BUILTIN(name) shared_ptr<Var> PackageMinosys::func##name (const vector<shared_ptr<Var> > &args)
-
-PackageMinosys::PackageMinosys() {
-  OPMAP(".", dot);
-  OPMAP("?", 3term);
-  OPMAP("=", assign);
-  OPMAP("+=", assignplus);
-  OPMAP("*=", assignmultiply);
-  OPMAP("-=", assignminus);
-  OPMAP("/=", assigndiv);
-  OPMAP("%=", assignmod);
-  OPMAP("&=", assignand);
-  OPMAP("|=", assignor);
-  OPMAP("^=", assignxor);
-  OPMAP("!", monoNot);
-  OPMAP("~", negate);
-  OPMAP("-m", monoMinus);
-  OPMAP("++x", preIncr);
-  OPMAP("x++", postIncr);
-  OPMAP("--x", preDecr);
-  OPMAP("x--", postDecr);
-  OPMAP("<", lt);
-  OPMAP("<=", lteq);
-  OPMAP(">", gt);
-  OPMAP(">=", gteq);
-  OPMAP("!=", neq);
-  OPMAP("==", eq);
-  OPMAP("+", plus);
-  OPMAP("-", minus);
-  OPMAP("*", multiply);
-  OPMAP("/", div);
-  OPMAP("%", mod);
-  OPMAP("&", and);
-  OPMAP("|", or);
-  OPMAP("^", xor);
-  OPMAP("&&", logand);
-  OPMAP("||", logor);
-  OPMAP("[", leftarray);
-
+#define BUILTIN(name) VarPtr PackageMinosys::func##name (const vector<VarPtr> &args)
+
+#define OPTABLE(name) &PackageMinosys::eval_op_##name
+
+// OpType の順に並べる; NULL は未定義の演算子
+const PackageMinosys::OpFunc PackageMinosys::optable[OT_MAX] = {
+  NULL,				// OT_NONE
+  OPTABLE(dot),
+  OPTABLE(3term),
+  OPTABLE(assign),
+  OPTABLE(assignplus),
+  OPTABLE(assignminus),
+  OPTABLE(assignmultiply),
+  OPTABLE(assigndiv),
+  OPTABLE(assignmod),
+  OPTABLE(assignand),
+  OPTABLE(assignor),
+  OPTABLE(assignxor),
+  OPTABLE(assignlsh),
+  OPTABLE(assignrsh),
+  OPTABLE(monoNot),
+  OPTABLE(negate),
+  OPTABLE(monoMinus),
+  OPTABLE(preIncr),
+  OPTABLE(postIncr),
+  OPTABLE(preDecr),
+  OPTABLE(postDecr),
+  OPTABLE(lt),
+  OPTABLE(lteq),
+  OPTABLE(gt),
+  OPTABLE(gteq),
+  OPTABLE(neq),
+  OPTABLE(eq),
+  OPTABLE(plus),
+  OPTABLE(minus),
+  OPTABLE(multiply),
+  OPTABLE(div),
+  OPTABLE(mod),
+  OPTABLE(and),
+  OPTABLE(or),
+  OPTABLE(xor),
+  OPTABLE(logand),
+  OPTABLE(logor),
+  OPTABLE(lsh),
+  OPTABLE(rsh),
+  OPTABLE(leftarray),
+  NULL,				// OT_ARRAY
+  NULL				// OT_NEW
+};
+
+PackageMinosys::PackageMinosys(Engine *eng) {
+  this->eng = eng;
   BUILTINMAP(builtinmap, "type", type);
   BUILTINMAP(builtinmap, "convert", convert);
   BUILTINMAP(builtinmap, "print", print);
@@ -304,11 +564,157 @@ PackageMinosys::PackageMinosys() {
 }
 
 PackageMinosys::~PackageMinosys() {
+  for (auto p = codes.begin(); p != codes.end(); ++p) {
+    delete p->second;
+  }
+  for (auto p = memberCodes.begin(); p != memberCodes.end(); ++p) {
+    for (auto pm = p->second.begin(); pm != p->second.end(); ++pm) {
+      delete pm->second;
+    }
+  }
+  // 構文木は top の arena ごと解放される
   delete top;
 }
 
+// 関数内の変数をスロットに割り当てる
+// 仮引数および代入先となる変数はローカルスロット、それ以外はグローバルスロットのみを持つ
+static void collectLocals(Content *c, unordered_map<Symbol, int> &locals) {
+  for (; c; c = c->next) {
+    if (c->tag == LexBase::LT_FUNCDEF) continue;
+    if (c->opcode >= OT_ASSIGN && c->opcode <= OT_POSTDECR
+      && c->opcode != OT_MONONOT && c->opcode != OT_NEGATE && c->opcode != OT_MONOMINUS) {
+      Content *lhs = c->pc.at(0);
+      if (lhs && lhs->tag == LexBase::LT_VAR && locals.find(lhs->op.id()) == locals.end()) {
+        int n = (int)locals.size();
+        locals[lhs->op.id()] = n;
+      }
+    }
+    for (auto p = c->pc.begin(); p != c->pc.end(); ++p) {
+      collectLocals(*p, locals);
+    }
+  }
+}
+
+// リテラルは定数表に登録し、その番号を slot に持つ
+static void assignSlots(Content *c, const unordered_map<Symbol, int> &locals, Engine *eng, vector<VarPtr> &consts) {
+  for (; c; c = c->next) {
+    VarPtr k;
+    switch (c->tag) {
+    case LexBase::LT_FUNCDEF:
+      continue;
+
+    case LexBase::LT_VAR:
+      {
+        auto p = locals.find(c->op.id());
+        c->slot = (p != locals.end()) ? p->second : -1;
+        c->gslot = eng->globalSlot(c->op.id());
+      }
+      break;
+
+    case LexBase::LT_NULL:
+      k = newVar();
+      break;
+
+    case LexBase::LT_INT:
+      k = newVar(c->inum);
+      break;
+
+    case LexBase::LT_DNUM:
+      k = newVar(c->dnum);
+      break;
+
+    case LexBase::LT_STRING:
+      k = newVar(c->op);
+      break;
+    }
+    if (k) {
+      k->constant = true;
+      c->slot = (int)consts.size();
+      consts.push_back(k);
+    }
+    for (auto p = c->pc.begin(); p != c->pc.end(); ++p) {
+      assignSlots(*p, locals, eng, consts);
+    }
+  }
+}
+
+static void resolveFunc(Content *def, Engine *eng, vector<VarPtr> &consts) {
+  unordered_map<Symbol, int> locals;
+  for (int i = 0; i < def->arg.size(); ++i) {
+    locals[def->arg[i].id()] = i;
+  }
+  int nargs = (int)def->arg.size();
+  int nlocals = nargs;
+  if (!def->pc.empty()) {
+    // 仮引数の後ろに代入先の変数を並べる
+    unordered_map<Symbol, int> assigned;
+    collectLocals(def->pc.at(0), assigned);
+    vector<Symbol> names(assigned.size());
+    for (auto p = assigned.begin(); p != assigned.end(); ++p) {
+      names[p->second] = p->first;
+    }
+    for (auto p = names.begin(); p != names.end(); ++p) {
+      if (locals.find(*p) == locals.end()) {
+        int n = nargs + (int)(p - names.begin());
+        locals[*p] = n;
+      }
+    }
+    nlocals += (int)names.size();
+    assignSlots(def->pc.at(0), locals, eng, consts);
+  }
+  def->inum = nlocals;
+}
+
+// 本体が未解析の関数は parseBody() で扱う
+void PackageMinosys::resolve() {
+  for (auto p = top->funcs.begin(); p != top->funcs.end(); ++p) {
+    if (top->parsed(p->second)) {
+      resolveFunc(p->second, eng, consts);
+    }
+  }
+  for (auto p = top->defines.begin(); p != top->defines.end(); ++p) {
+    for (auto pm = p->second->members.begin(); pm != p->second->members.end(); ++pm) {
+      if (top->parsed(pm->second)) {
+        resolveFunc(pm->second, eng, consts);
+      }
+    }
+  }
+}
+
+// 関数およびクラスメンバー関数を bytecode に変換する
+// 平坦化した木は関数ごとに作り、変換が済めば捨てる
+void PackageMinosys::compile() {
+  Compiler comp;
+  for (auto p = top->funcs.begin(); p != top->funcs.end(); ++p) {
+    if (top->parsed(p->second)) {
+      FlatTree flat;
+      codes[p->first] = comp.compile(flat, flat.add(p->second));
+    }
+  }
+  for (auto p = top->defines.begin(); p != top->defines.end(); ++p) {
+    unordered_map<string, ByteCode *> &m = memberCodes[p->first];
+    for (auto pm = p->second->members.begin(); pm != p->second->members.end(); ++pm) {
+      if (top->parsed(pm->second)) {
+        FlatTree flat;
+        m[pm->first] = comp.compile(flat, flat.add(pm->second));
+      }
+    }
+  }
+}
+
+// 読み飛ばした関数本体を最初の呼び出し時に構文解析し、resolve と compile を行う
+void PackageMinosys::parseBody(Symbol fname, Content *def) {
+  top->body(def);
+  resolveFunc(def, eng, consts);
+  if (eng->useBytecode) {
+    FlatTree flat;
+    Compiler comp;
+    codes[fname] = comp.compile(flat, flat.add(def));
+  }
+}
+
 // パッケージ関数呼び出し
-shared_ptr<Var> PackageMinosys::start(const string &fname, vector<shared_ptr<Var> > &args) {
+VarPtr PackageMinosys::start(Symbol fname, vector<VarPtr> &args) {
   auto p = top->funcs.find(fname);
  if (p == top->funcs.end()) {
     // ビルトイン関数
@@ -325,22 +731,32 @@ shared_ptr<Var> PackageMinosys::start(const string &fname, vector<shared_ptr<Var
     }
  } else {
     Content *c = p->second;
-    unordered_map<string, shared_ptr<Var> > amap;
+    if (!top->parsed(c)) {
+      parseBody(fname, c);
+    }
 
     // TODO: 仮引数に過不足がある場合はデフォルト推定する
     if (c->arg.size() != args.size()) {
-cout << "c->arg:" << c->arg.size() << ", args:" << args.size() << endl;
-      throw RuntimeException(903, string("Arg size not matched:") + fname);
+      throw RuntimeException(903, string("Arg size not matched:") + eng->symbols.name(fname));
     }
 
+    // ローカル変数スロット; 先頭は仮引数 (c->inum は resolve で設定したスロット数)
+    vector<VarPtr> slots(c->inum);
     for (int i = 0; i < args.size(); ++i) {
-      amap[c->arg[i]] = args[i];
+      slots[i] = bindVar(args[i]);
     }
     eng->varmark.push_back(eng->vars.size());
     eng->topmark.push_back(eng->paramstack.size());
     eng->callmark.push_back(eng->callstack.size());
-    eng->vars.push_back(amap);
-    shared_ptr<Var> rv = callfunc(fname, c->pc.at(0));
+    eng->vars.push_back(unordered_map<Symbol, VarPtr>());
+    eng->frames.push_back(slots.data());
+    VarPtr rv;
+    auto pc = codes.find(fname);
+    if (eng->useBytecode && pc != codes.end()) {
+      rv = execute(pc->second);
+    } else {
+      rv = callfunc(c->pc.at(0));
+    }
     if (eng->topmark.back() > eng->paramstack.size()) {
       eng->paramstack.erase(
         eng->paramstack.begin() + eng->topmark.back(),
@@ -355,16 +771,17 @@ cout << "c->arg:" << c->arg.size() << ", args:" << args.size() << endl;
       eng->callstack.begin() + eng->callmark.back(),
       eng->callstack.end()
     );
+    eng->frames.pop_back();
     eng->varmark.pop_back();
     eng->topmark.pop_back();
     eng->callmark.pop_back();
     return rv;
   }
-  throw RuntimeException(900, string("Unknown function/method:") + fname);
+  throw RuntimeException(900, string("Unknown function/method:") + eng->symbols.name(fname));
 }
 
 // 関数呼び出し
-shared_ptr<Var> PackageMinosys::callfunc(const string &fname, Content *c) {
+VarPtr PackageMinosys::callfunc(Content *c) {
   while (c) {
     bool redo = false;
     switch (c->tag) {
@@ -378,7 +795,7 @@ shared_ptr<Var> PackageMinosys::callfunc(const string &fname, Content *c) {
 
     case LexBase::LT_IF:
       {
-        shared_ptr<Var> r = evaluate(c->pc.at(0));
+        VarPtr r = evaluate(c->pc.at(0));
         if (r && r.get()->isTrue()) {
           eng->callstack.push_back(c);
           c = c->pc.at(1);
@@ -394,7 +811,7 @@ shared_ptr<Var> PackageMinosys::callfunc(const string &fname, Content *c) {
     case LexBase::LT_FOR:
       {
         evaluate(c->pc.at(0));
-        shared_ptr<Var> r = evaluate(c->pc.at(1));
+        VarPtr r = evaluate(c->pc.at(1));
         if (r && r->isTrue()) {
           eng->callstack.push_back(c);
           c = c->pc.at(3);
@@ -405,7 +822,7 @@ shared_ptr<Var> PackageMinosys::callfunc(const string &fname, Content *c) {
 
     case LexBase::LT_WHILE:
       {
-        shared_ptr<Var> r = evaluate(c->pc.at(0));
+        VarPtr r = evaluate(c->pc.at(0));
         if (r && r.get()->isTrue()) {
           eng->callstack.push_back(c);
           c = c->pc.at(1);
@@ -416,88 +833,82 @@ shared_ptr<Var> PackageMinosys::callfunc(const string &fname, Content *c) {
 
     case LexBase::LT_BREAK:
       {
-        auto p = top->labels.find(fname);
-        if (p != top->labels.end() && !c->op.empty()) {
-          auto pl = p->second.find(c->pc.at(0)->op);
-          if (pl != p->second.end()) {
-            int mark = eng->callstack.size() - eng->callmark.back() - pl->second.nest;
-            if (mark == 0) {
-              eng->callstack.erase(eng->callstack.begin() + pl->second.nest, eng->callstack.end());
-              c = pl->second.content;
-              break;
-            }
-          }
-        }
-        if (eng->callstack.size() > eng->callmark.back()) {
-          c = eng->callstack.back();
-          eng->callstack.pop_back();
+        // ループを抜ける; ループの外であれば関数を抜ける
+        Content *loop = unwindLoop(c);
+        if (!loop) {
+          return newVar();
         }
+        eng->callstack.pop_back();
+        c = loop;
       }
       break;
 
     case LexBase::LT_CONTINUE:
       {
-        auto p = top->labels.find(fname);
-        if (p != top->labels.end() && !c->op.empty()) {
-          auto pl = p->second.find(c->pc.at(0)->op);
-          if (pl != p->second.end()) {
-            int mark = eng->callstack.size() - eng->callmark.back() - pl->second.nest;
-            if (mark == 0) {
-              eng->callstack.erase(eng->callstack.begin() + pl->second.nest, eng->callstack.end());
-              c = pl->second.content;
-              redo = true;
-              break;
-            }
-          }
-        }
-        if (eng->callstack.size() > eng->callmark.back()) {
-          c = eng->callstack.back();
-          eng->callstack.pop_back();
-          redo = true;
+        // 次の繰り返しへ; ループの外であれば関数を抜ける
+        Content *loop = unwindLoop(c);
+        if (!loop) {
+          return newVar();
         }
+        eng->callstack.pop_back();
+        c = nextStatement(loop);
+        redo = true;
       }
       break;
 
-
     case LexBase::LT_RETURN:
       if (c->pc.size() >= 1) {
         return evaluate(c->pc.at(0));
       }
-      return make_shared<Var>();
+      return newVar();
 
     default: // 演算子
       evaluate(c);
     }
-    if (redo) {
-      continue;
+    if (!redo) {
+      c = c->next;
     }
-    c = c->next;
-    if (!c && eng->callstack.size() > eng->callmark.back()) {
+    while (!c && eng->callstack.size() > eng->callmark.back()) {
       c = eng->callstack.back();
       eng->callstack.pop_back();
-      if (c->tag == LexBase::LT_FOR) {
-        evaluate(c->pc.at(2));
-        shared_ptr<Var> r = evaluate(c->pc.at(1));
-        if (r && r.get()->isTrue()) {
-          eng->callstack.push_back(c);
-          c = c->pc.at(3);
-        } else {
-          c = c->next;
-        }
-      } else if (c->tag == LexBase::LT_WHILE) {
-        shared_ptr<Var> r = evaluate(c->pc.at(0));
-        if (r && r.get()->isTrue()) {
-          eng->callstack.push_back(c);
-          c = c->pc.at(1);
-        } else {
-          c = c->next;
-        }
-      } else {
-        c = c->next;
-      }
+      c = nextStatement(c);
     }
   }
-  return make_shared<Var>();
+  return newVar();
+}
+
+// ブロック終端に達した文の次に実行する文を返す
+// for/while であれば条件を再評価する
+Content *PackageMinosys::nextStatement(Content *c) {
+  if (c->tag == LexBase::LT_FOR) {
+    evaluate(c->pc.at(2));
+    VarPtr r = evaluate(c->pc.at(1));
+    if (r && r.get()->isTrue()) {
+      eng->callstack.push_back(c);
+      return c->pc.at(3);
+    }
+  } else if (c->tag == LexBase::LT_WHILE) {
+    VarPtr r = evaluate(c->pc.at(0));
+    if (r && r.get()->isTrue()) {
+      eng->callstack.push_back(c);
+      return c->pc.at(1);
+    }
+  }
+  return c->next;
+}
+
+// break/continue の対象となるループまで callstack を巻き戻す
+// ラベル指定があればそのラベルを持つループ、なければ最も内側のループ
+Content *PackageMinosys::unwindLoop(Content *c) {
+  while (eng->callstack.size() > eng->callmark.back()) {
+    Content *t = eng->callstack.back();
+    if ((t->tag == LexBase::LT_FOR || t->tag == LexBase::LT_WHILE)
+      && (c->op.empty() || t->label == c->op)) {
+      return t;
+    }
+    eng->callstack.pop_back();
+  }
+  return NULL;
 }
 
 // 変数型を返す
@@ -506,7 +917,7 @@ BUILTIN(type) {
   if (!args.empty()) {
     vtype = (int)args[0]->vtype;
   }
-  return make_shared<Var>(vtype);
+  return newVar(vtype);
 }
 
 // 変数間の型変換
@@ -519,13 +930,13 @@ BUILTIN(convert) {
     case VT_INT:
       switch (args[0]->vtype) {
       case VT_INT:
-        return make_shared<Var>(args[0]->inum);
+        return newVar(args[0]->inum);
 
       case VT_DNUM:
-        return make_shared<Var>((int)args[0]->dnum);
+        return newVar((int)args[0]->dnum);
 
       case VT_STRING:
-        return make_shared<Var>(atoi(args[0]->str.c_str()));
+        return newVar(atoi(args[0]->str().c_str()));
 
       default:
         return args[0]->clone();
@@ -535,13 +946,13 @@ BUILTIN(convert) {
     case VT_DNUM:
       switch (args[0]->vtype) {
       case VT_INT:
-        return make_shared<Var>((double)args[0]->inum);
+        return newVar((double)args[0]->inum);
 
       case VT_DNUM:
-        return make_shared<Var>(args[0]->dnum);
+        return newVar(args[0]->dnum);
 
       case VT_STRING:
-        return make_shared<Var>(atof(args[0]->str.c_str()));
+        return newVar(atof(args[0]->str().c_str()));
         break;
 
       default:
@@ -552,13 +963,13 @@ BUILTIN(convert) {
     case VT_STRING:
       switch (args[0]->vtype) {
       case VT_INT:
-        return make_shared<Var>(to_string(args[0]->inum));
+        return newVar(to_string(args[0]->inum));
 
       case VT_DNUM:
-        return make_shared<Var>(to_string(args[0]->dnum));
+        return newVar(to_string(args[0]->dnum));
 
       case VT_STRING:
-        return make_shared<Var>(args[0]->str);
+        return newVar(args[0]->str());
 
       default:
         return args[0]->clone();
@@ -569,7 +980,7 @@ BUILTIN(convert) {
       return args[0]->clone();
     }
   }
-  return make_shared<Var>();
+  return newVar();
 }
 
 // print 関数; 表示文字数を返す
@@ -587,18 +998,18 @@ BUILTIN(print) {
       break;
 
     case VT_STRING:
-      len += printf("%.*s", (int)(*p)->str.size(), (*p)->str.data());
+      len += printf("%.*s", (int)(*p)->str().size(), (*p)->str().data());
       break;
 
     case VT_INST:
       {
-        vector<shared_ptr<Var> > args;
-        shared_ptr<Var> r = this->start("toString", args);
+        vector<VarPtr> args;
+        VarPtr r = this->start(eng->symbols.symbol("toString"), args);
         if (r) {
-          vector<shared_ptr<Var> > args;
-          shared_ptr<Var> v(r->clone());
+          vector<VarPtr> args;
+          VarPtr v(r->clone());
           args.push_back(v);
-          shared_ptr<Var> vr = funcprint(args);
+          VarPtr vr = funcprint(args);
           if (vr->vtype == VT_INT) {
             len += vr->inum;
           }
@@ -607,27 +1018,43 @@ BUILTIN(print) {
       break;
 
     case VT_ARRAY:
-      len += printf("{");
-      for (auto pc = (*p)->arrayhash.begin(); pc != (*p)->arrayhash.end(); ++pc, ++count) {
-        if (count) {
-          len += printf(",");
+      {
+        // 整数の添字の要素を順に表示し、残りを続ける
+        const VarArray &a = (*p)->array();
+        len += printf("{");
+        for (size_t i = 0; i < a.listPart().size(); ++i, ++count) {
+          if (count) {
+            len += printf(",");
+          }
+          len += printf("%zu: ", i);
+          vector<VarPtr> args;
+          args.push_back(a.listPart()[i]);
+          VarPtr vr = funcprint(args);
+          if (vr->vtype == VT_INT) {
+            len += vr->inum;
+          }
         }
-        string s = pc->first.toString();
-        len += printf("%.*s: ", (int)s.size(), s.data());
-        vector<shared_ptr<Var> > args;
-        args.push_back(pc->second);
-        shared_ptr<Var> vr = funcprint(args);
-        if (vr->vtype == VT_INT) {
-          len += vr->inum;
+        for (auto pc = a.hashPart().begin(); pc != a.hashPart().end(); ++pc, ++count) {
+          if (count) {
+            len += printf(",");
+          }
+          string s = pc->first.toString();
+          len += printf("%.*s: ", (int)s.size(), s.data());
+          vector<VarPtr> args;
+          args.push_back(pc->second);
+          VarPtr vr = funcprint(args);
+          if (vr->vtype == VT_INT) {
+            len += vr->inum;
+          }
         }
+        len += printf("}");
       }
-      len += printf("}");
       break;
 
     case VT_FUNC:
       {
-        const string &pac = (*p)->func.first;
-        const string &fname = (*p)->func.second;
+        const string &pac = eng->symbols.name((*p)->func().package);
+        const string &fname = eng->symbols.name((*p)->func().name);
         if (pac.empty()) {
           len += printf("%.*s", (int)fname.size(), fname.data());
         } else {
@@ -638,13 +1065,13 @@ BUILTIN(print) {
 
     case VT_MEMBER:
       {
-        vector<shared_ptr<Var> > args;
-        args.push_back((*p)->member.first);
-        shared_ptr<Var> vr =  funcprint(args);
+        vector<VarPtr> args;
+        args.push_back((*p)->member().first);
+        VarPtr vr =  funcprint(args);
         if (vr->vtype == VT_INT) {
           len += vr->inum;
         }
-        string &mem = (*p)->member.second;
+        const string &mem = eng->symbols.name((*p)->member().second);
         len += printf(".%.*s", (int)mem.size(), mem.data());
       }
       break;
@@ -653,7 +1080,7 @@ BUILTIN(print) {
       ;
     }
   }
-  return make_shared<Var>(len);
+  return newVar(len);
 }
 
 // 終了関数
@@ -670,7 +1097,7 @@ BUILTIN(exit) {
       break;
 
     case VT_STRING:
-      code = atoi((*args[0]).str.c_str());
+      code = atoi((*args[0]).str().c_str());
       break;
     }
   }
@@ -680,7 +1107,7 @@ BUILTIN(exit) {
 // string: s.at(pos)
 BUILTIN(at) {
   if (args.size() == 2) {
-    shared_ptr<Var> a2 = args.at(1);
+    VarPtr a2 = args.at(1);
     int pos = 0;
     switch (a2->vtype) {
     case VT_INT:
@@ -694,39 +1121,39 @@ BUILTIN(at) {
     default:
       throw new RuntimeException(1005, "illegal argument");
     }
-    shared_ptr<Var> a1 = args.at(0);
-    if (-pos > 0 && -pos <= a1->str.size()) {
-      pos = a1->str.size() + pos;
+    VarPtr a1 = args.at(0);
+    if (-pos > 0 && -pos <= a1->str().size()) {
+      pos = a1->str().size() + pos;
     }
-    if (pos >= 0 && pos < a1->str.size()) {
-      return make_shared<Var>(a1->str.substr(pos, 1));
+    if (pos >= 0 && pos < a1->str().size()) {
+      return newVar(a1->str().substr(pos, 1));
     }
-    return make_shared<Var>("");
+    return newVar("");
   }
   throw new RuntimeException(1005, "illegal argument");
 }
 
 // string: s.empty()
 BUILTIN(empty) {
-  return make_shared<Var>(args.at(0)->str.empty() ? 1 : 0);
+  return newVar(args.at(0)->strSize() == 0 ? 1 : 0);
 }
 
 // string: s.length()
 BUILTIN(length) {
-  return make_shared<Var>((int)(args.at(0)->str.size()));
+  return newVar((int)args.at(0)->strSize());
 }
 
 // string: s.index(s2, [start])
 BUILTIN(index) {
   if (args.size() >= 2) {
     int pos = 0;
-    shared_ptr<Var> a1 = args.at(0);
-    shared_ptr<Var> a2 = args.at(1);
+    VarPtr a1 = args.at(0);
+    VarPtr a2 = args.at(1);
     if (a2->vtype != VT_STRING) {
-      return make_shared<Var>(-1);
+      return newVar(-1);
     }
     if (args.size() > 2) {
-      shared_ptr<Var> a3 = args.at(2);
+      VarPtr a3 = args.at(2);
       switch (a3->vtype) {
       case VT_INT:
         pos = a3->inum;
@@ -737,30 +1164,30 @@ BUILTIN(index) {
         break;
 
       default:
-        return make_shared<Var>(-1);
+        return newVar(-1);
       }
     }
-    if (-pos > 0 && -pos <= a1->str.size()) {
-      pos = a1->str.size() + pos;
+    if (-pos > 0 && -pos <= a1->str().size()) {
+      pos = a1->str().size() + pos;
     }
-    if (pos >= 0 && pos < a1->str.size()) {
-      return make_shared<Var>((int)a1->str.find(a2->str, pos));
+    if (pos >= 0 && pos < a1->str().size()) {
+      return newVar((int)a1->str().find(a2->str(), pos));
     }
   }
-  return make_shared<Var>(-1);
+  return newVar(-1);
 }
 
 // string: s.rindex(s2, [start])
 BUILTIN(rindex) {
   if (args.size() >= 2) {
     int pos = 0;
-    shared_ptr<Var> a1 = args.at(0);
-    shared_ptr<Var> a2 = args.at(1);
+    VarPtr a1 = args.at(0);
+    VarPtr a2 = args.at(1);
     if (a2->vtype != VT_STRING) {
-      return make_shared<Var>(-1);
+      return newVar(-1);
     }
     if (args.size() > 2) {
-      shared_ptr<Var> a3 = args.at(2);
+      VarPtr a3 = args.at(2);
       switch (a3->vtype) {
       case VT_INT:
         pos = a3->inum;
@@ -771,25 +1198,25 @@ BUILTIN(rindex) {
         break;
 
       default:
-        return make_shared<Var>(-1);
+        return newVar(-1);
       }
     }
-    if (-pos > 0 && -pos <= a1->str.size()) {
-      pos = a1->str.size() + pos;
+    if (-pos > 0 && -pos <= a1->str().size()) {
+      pos = a1->str().size() + pos;
     }
-    if (pos >= 0 && pos < a1->str.size()) {
-      return make_shared<Var>((int)a1->str.rfind(a2->str, pos));
+    if (pos >= 0 && pos < a1->str().size()) {
+      return newVar((int)a1->str().rfind(a2->str(), pos));
     }
   }
-  return make_shared<Var>(-1);
+  return newVar(-1);
 }
 
 // string s.substr(start, [size])
 BUILTIN(substr) {
   if (args.size() >= 2) {
-    shared_ptr<Var> a1 = args.at(0);
-    shared_ptr<Var> a2 = args.at(1);
-    int start = 0, width = a1->str.size();
+    VarPtr a1 = args.at(0);
+    VarPtr a2 = args.at(1);
+    int start = 0, width = a1->str().size();
     switch (a2->vtype) {
     case VT_INT:
       start = a2->inum;
@@ -804,7 +1231,7 @@ BUILTIN(substr) {
     }
 
     if (args.size() > 2) {
-      shared_ptr<Var> a3 = args.at(2);
+      VarPtr a3 = args.at(2);
       switch (a3->vtype) {
       case VT_INT:
         width = a3->inum;
@@ -819,16 +1246,16 @@ BUILTIN(substr) {
       }
     }
     if (width < 0) {
-      width = a1->str.size();
+      width = a1->str().size();
     }
 
-    if (-start > 0 && -start <= a1->str.size()) {
-      start = a1->str.size() + start;
+    if (-start > 0 && -start <= a1->str().size()) {
+      start = a1->str().size() + start;
     }
-    if (start + width > a1->str.size()) {
-      width = a1->str.size() - start;
+    if (start + width > a1->str().size()) {
+      width = a1->str().size() - start;
     }
-    return make_shared<Var>(a1->str.substr(start, width));
+    return newVar(a1->str().substr(start, width));
   }
   return args.at(0);
 }
@@ -838,18 +1265,71 @@ PackageDlopen::~PackageDlopen() {
   dlclose(dlhandle);
 }
 
-shared_ptr<Var> PackageDlopen::start(const string &fname, vector<shared_ptr<Var> > &args) {
-  void *p = dlsym(dlhandle, fname.c_str());
-  if (p) {
+// 高速呼び出し ABI の関数表を登録する; モジュールが対応していなければ何もしない
+void PackageDlopen::init() {
+  const minosys_module *(*pinit)(int) =
+    (const minosys_module *(*)(int))dlsym(dlhandle, "minosys_module_init");
+  if (!pinit) return;
+  const minosys_module *m = (*pinit)(MINOSYS_ABI_VERSION);
+  if (!m || m->version != MINOSYS_ABI_VERSION) return;
+  for (int i = 0; i < m->nfuncs; ++i) {
+    Native &n = native(eng->symbols.symbol(m->funcs[i].name));
+    n.kind = Native::FAST;
+    n.nargs = m->funcs[i].nargs;
+    n.func = (void *)m->funcs[i].func;
+  }
+}
+
+VarPtr PackageDlopen::start(Symbol fsym, vector<VarPtr> &args) {
+  Native &n = native(fsym);
+  if (n.kind == Native::UNRESOLVED) {
+    void *p = dlsym(dlhandle, eng->symbols.name(fsym).c_str());
+    n.kind = p ? Native::START : Native::MISSING;
+    n.func = p;
+  }
+  if (n.kind == Native::FAST) {
+    void *stackargs[MAXFASTARGS];
+    vector<void *> heapargs;
+    void **argv = stackargs;
+    if (args.size() > MAXFASTARGS) {
+      heapargs.resize(args.size());
+      argv = heapargs.data();
+    }
+    for (size_t i = 0; i < args.size(); ++i) {
+      argv[i] = args[i].get();
+    }
+    return callFast(n, fsym, argv, (int)args.size());
+  }
+  if (n.kind == Native::START) {
     int (*pstart)(void *, void *, const char *, void *) =
-      (int (*)(void *, void *, const char *, void *))p;
-    shared_ptr<Var> rval;
-    int r = (*pstart)((void **)&rval, eng, fname.c_str(), &args);
-    if (r == 0) {
-      return rval;
+      (int (*)(void *, void *, const char *, void *))n.func;
+    // 戻り値は new Var で作成されたもの; 所有権を引き取る
+    void *rval = NULL;
+    int r = (*pstart)(&rval, eng, eng->symbols.name(fsym).c_str(), &args);
+    if (r == 0 && rval) {
+      return VarPtr((Var *)rval);
     }
   }
-  return make_shared<Var>();
+  return newVar();
+}
+
+// 高速呼び出し ABI の関数を呼ぶ; args は Var * の列
+VarPtr PackageDlopen::callFast(const Native &n, Symbol fsym, void *const *args, int nargs) {
+  if (n.nargs >= 0 && n.nargs != nargs) {
+    throw RuntimeException(903, string("Arg size not matched:") + eng->symbols.name(fsym));
+  }
+  // 呼び出し中に natives が伸びても困らないよう先に取り出す
+  minosys_fastfunc f = (minosys_fastfunc)n.func;
+  void *rval = NULL;
+  int r = (*f)(&rval, eng, args, nargs);
+  if (r == 0 && rval) {
+    return VarPtr((Var *)rval);
+  }
+  return newVar();
+}
+
+Engine::Engine(const vector<string> &searchPaths) : ar(NULL), searchPaths(searchPaths), currentPackage(0), useBytecode(true), useCache(true), lazyParse(false), loaderThreads(0) {
+  symThis = symbols.symbol("this");
 }
 
 Engine::~Engine() {
@@ -861,88 +1341,302 @@ Engine::~Engine() {
 void Engine::setArchive(const string &arname) {
   for (auto p = searchPaths.begin(); p != searchPaths.end(); ++p) {
     string path = *p + "/" + arname + ".minosys";
-    char sig[4];
-    FILE *f = fopen(path.c_str(), "r");
-    if (f) {
-      if (fread(&sig[0], 1, sizeof(sig), f) == sizeof(sig)
-        && sig[0] == 'm' && sig[1] == 'p' && sig[2] == 'k' && sig[3] == '2') {
-        ar = new Archive();
-        ar->f = f;
-        ar->createMap();
-        return;
-      }
-      fclose(f);
+    Archive *a = new Archive();
+    if (a->open(path)) {
+      ar = a;
+      return;
     }
+    delete a;
   }
 }
 
-void Engine::Archive::createMap() {
-  int nelem, maxlen = 100;
-  char *buf = new char[100];
-  fread(&nelem, 1, sizeof(int), f);
-  vector<Elem> vecElem;
+Engine::Archive::~Archive() {
+  if (map) {
+    munmap(map, maplen);
+  }
+}
+
+static int compareKey(const TokenText &a, const TokenText &b) {
+  int r = memcmp(a.data(), b.data(), min(a.size(), b.size()));
+  if (r != 0) return r;
+  return a.size() < b.size() ? -1 : a.size() > b.size() ? 1 : 0;
+}
+
+bool Engine::Archive::less(uint32_t a, uint32_t b) const {
+  return compareKey(key(a), key(b)) < 0;
+}
+
+// 全体を読み取り専用で共有 map する; 同じアーカイブを開くプロセスはページキャッシュを共有する
+bool Engine::Archive::open(const string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat sb;
+  if (fstat(fd, &sb) < 0 || sb.st_size < 8) {
+    close(fd);
+    return false;
+  }
+  void *m = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (m == MAP_FAILED) return false;
+  map = m;
+  maplen = (size_t)sb.st_size;
+
+  const char *p = (const char *)map;
+  int32_t n;
+  memcpy(&n, p + 4, sizeof(n));
+  if (memcmp(p, "mpk2", 4) != 0 || n < 0
+    || (size_t)n > (maplen - 8) / sizeof(Elem)) {
+    return false;
+  }
+  elems = (const Elem *)(p + 8);
+  nelem = (uint32_t)n;
+  for (uint32_t i = 0; i < nelem; ++i) {
+    const Elem &e = elems[i];
+    if (e.key_offset < 0 || e.key_length < 0 || e.val_offset < 0 || e.val_length < 0
+      || (size_t)e.key_offset + e.key_length > maplen
+      || (size_t)e.val_offset + e.val_length > maplen) {
+      return false;
+    }
+  }
 
-  for (int i = 0; i < nelem; ++i) {
-    Elem e;
-    fread(&e.key_offset, 1, sizeof(int), f);
-    fread(&e.key_length, 1, sizeof(int), f);
-    fread(&e.val_offset, 1, sizeof(int), f);
-    fread(&e.val_length, 1, sizeof(int), f);
-    vecElem.push_back(e);
+  // 要素表がキー順に並んでいればそのまま二分探索する
+  // そうでなければ添字だけを並べ替えて持つ
+  for (uint32_t i = 1; i < nelem; ++i) {
+    if (!less(i - 1, i)) {
+      order.resize(nelem);
+      for (uint32_t k = 0; k < nelem; ++k) {
+        order[k] = k;
+      }
+      stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return less(a, b); });
+      break;
+    }
   }
-  for (auto p = vecElem.begin(); p != vecElem.end(); ++p) {
-    fseek(f, p->key_offset, SEEK_SET);
-    if (maxlen < p->key_length) {
-      maxlen = p->key_length;
-      if (buf) delete buf;
-      buf = new char[maxlen];
+  return true;
+}
+
+// name の本体をマッピング上の位置で返す
+bool Engine::Archive::find(const string &name, const char *&data, size_t &len) const {
+  TokenText k(name.data(), name.size());
+  uint32_t lo = 0, hi = nelem;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    uint32_t i = order.empty() ? mid : order[mid];
+    int r = compareKey(key(i), k);
+    if (r < 0) {
+      lo = mid + 1;
+    } else if (r > 0) {
+      hi = mid;
+    } else {
+      // 同じキーが複数あれば後のものを使う
+      while (!order.empty() && mid + 1 < nelem && compareKey(key(order[mid + 1]), k) == 0) {
+        i = order[++mid];
+      }
+      data = (const char *)map + elems[i].val_offset;
+      len = (size_t)elems[i].val_length;
+      return true;
     }
-    fread(buf, 1, p->key_length, f);
-    string key(buf, p->key_length);
-    map[key] = pair<int, int>(p->val_offset, p->val_length);
   }
-  delete buf;
+  return false;
 }
 
-string Engine::Archive::findMap(const std::string &name) {
-  auto p = map.find(name);
-  if (p != map.end()) {
-    string s(p->second.second, '\0');
-    fseek(f, p->second.first, SEEK_SET);
-    fread((void *)s.data(), 1, p->second.second, f);
-    return s;
+// name の kind の要素のキー
+string Engine::Archive::key(const string &name, Kind kind, bool compressed) {
+  if (kind == SOURCE && !compressed) {
+    return name;
   }
-  return string();
+  string k = name;
+  k += '\0';
+  if (kind == COMPILED) k += 'c';
+  if (compressed) k += 'z';
+  return k;
 }
 
+// パッケージ name の kind の本体を返す
+// 圧縮されていれば buf に展開してそこを指す; 圧縮されていなければマッピング上を指す
+bool Engine::Archive::entry(const string &name, Kind kind, string &buf, const char *&data, size_t &len) const {
+  if (find(key(name, kind, false), data, len)) {
+    return true;
+  }
+  const char *z;
+  size_t zlen;
+  uint32_t rawlen;
+  if (!find(key(name, kind, true), z, zlen) || zlen < sizeof(rawlen)) {
+    return false;
+  }
+  memcpy(&rawlen, z, sizeof(rawlen));
+  buf.resize(rawlen);
+  uLongf n = rawlen;
+  if (uncompress((Bytef *)&buf[0], &n, (const Bytef *)z + sizeof(rawlen), (uLong)(zlen - sizeof(rawlen))) != Z_OK
+    || n != rawlen) {
+    return false;
+  }
+  data = buf.data();
+  len = buf.size();
+  return true;
+}
+
+// パッケージを読み込む
+// import をたどって見つかったパッケージはスレッドプールで並行して構文解析し、
+// 登録は逐次で読み込んだ場合と同じ順序 (深さ優先) でメインスレッドが行う
 bool Engine::analyzePackage(const string &pacname, bool current) {
   auto p = packages.find(pacname);
   if (p != packages.end()) {
     // 定義済み
     return true;
   }
-  if (ar) {
-    auto pa = ar->map.find(pacname);
-    if (pa != ar->map.end()) {
-      // アーカイブに発見; minosys script でなければならない
-      string s = ar->findMap(pacname);
-      LexString lex(s.data(), (int)s.size());
-      ContentTop *top = new ContentTop();
-      if (top->yylex(&lex)) {
-        // minosys script として認識
-        shared_ptr<PackageMinosys> pm(new PackageMinosys());
-        pm->ptype = PackageBase::PT_MINOSYS;
-        pm->top = top;
-        pm->eng = this;
-        packages[pacname] = dynamic_pointer_cast<PackageBase>(pm);
-        if (current) {
-          packages[""] = packages[pacname];
+  unordered_map<string, LoadedPackage> loaded;
+  loadImports(pacname, loaded);
+  if (loaded.find(pacname) == loaded.end()) {
+    return false;
+  }
+  registerPackage(pacname, loaded, current);
+  return true;
+}
+
+// pacname とそこから import されるパッケージをすべて読み込む
+// 読み込めなかったパッケージは loaded に含まれない
+void Engine::loadImports(const string &pacname, unordered_map<string, LoadedPackage> &loaded) {
+  mutex m;
+  condition_variable cv;
+  deque<string> queue;
+  unordered_set<string> seen;	// 重複と循環を除く
+  int active = 0;
+  exception_ptr error;	// 最初に投げられた例外; 全スレッドの終了後に投げ直す
+  queue.push_back(pacname);
+  seen.insert(pacname);
+
+  auto worker = [&]() {
+    unique_lock<mutex> g(m);
+    while (true) {
+      cv.wait(g, [&]() { return !queue.empty() || active == 0; });
+      if (queue.empty()) {
+        break;
+      }
+      string name = queue.front();
+      queue.pop_front();
+      ++active;
+      g.unlock();
+      LoadedPackage lp;
+      bool found = false;
+      try {
+        found = loadPackage(name, lp);
+      } catch (...) {
+        g.lock();
+        if (!error) {
+          error = current_exception();
         }
-        for (auto vpac = top->imports.begin(); vpac != top->imports.end(); ++vpac) {
-          analyzePackage(*vpac);
+        g.unlock();
+      }
+      g.lock();
+      --active;
+      if (found) {
+        if (lp.top) {
+          for (auto pi = lp.top->imports.begin(); pi != lp.top->imports.end(); ++pi) {
+            if (packages.find(*pi) == packages.end() && seen.insert(*pi).second) {
+              queue.push_back(*pi);
+            }
+          }
         }
+        loaded[name] = lp;
+      }
+      cv.notify_all();
+    }
+  };
+
+  int nthreads = loaderThreads > 0 ? loaderThreads : (int)thread::hardware_concurrency();
+  vector<thread> pool;
+  for (int i = 1; i < nthreads; ++i) {
+    pool.push_back(thread(worker));
+  }
+  worker();
+  for (auto pt = pool.begin(); pt != pool.end(); ++pt) {
+    pt->join();
+  }
+  if (error) {
+    for (auto pl = loaded.begin(); pl != loaded.end(); ++pl) {
+      delete pl->second.top;
+      if (pl->second.dlhandle) {
+        dlclose(pl->second.dlhandle);
+      }
+    }
+    loaded.clear();
+    rethrow_exception(error);
+  }
+}
+
+// 読み込んだパッケージを import の深さ優先順に登録する
+void Engine::registerPackage(const string &pacname, unordered_map<string, LoadedPackage> &loaded, bool current) {
+  if (packages.find(pacname) != packages.end()) {
+    return;
+  }
+  auto pl = loaded.find(pacname);
+  if (pl == loaded.end()) {
+    return;
+  }
+  LoadedPackage &lp = pl->second;
+  if (lp.ptype == PackageBase::PT_DLOPEN) {
+    shared_ptr<PackageDlopen> pd = make_shared<PackageDlopen>();
+    pd->ptype = PackageBase::PT_DLOPEN;
+    pd->name = pacname;
+    pd->path = lp.path;
+    pd->dlhandle = lp.dlhandle;
+    pd->eng = this;
+    pd->init();
+    addPackage(pacname, pd, current);
+    return;
+  }
+  shared_ptr<PackageMinosys> pm = make_shared<PackageMinosys>(this);
+  pm->ptype = PackageBase::PT_MINOSYS;
+  pm->name = pacname;
+  pm->path = lp.path;
+  pm->top = lp.top;
+  pm->eng = this;
+  pm->resolve();
+  if (useBytecode) {
+    pm->compile();
+  }
+  addPackage(pacname, pm, current);
+  for (auto vpac = lp.top->imports.begin(); vpac != lp.top->imports.end(); ++vpac) {
+    registerPackage(*vpac, loaded, false);
+  }
+}
+
+// パッケージを探して構文解析する; 別スレッドから呼ばれる
+// Engine の状態は変更せず、symbols への登録だけを行う
+bool Engine::loadPackage(const string &pacname, LoadedPackage &lp) {
+  if (ar) {
+    // アーカイブに発見; minosys script でなければならない
+    string buf;
+    const char *data;
+    size_t len;
+    if (useCache && ar->entry(pacname, Archive::COMPILED, buf, data, len)) {
+      // 事前コンパイル済みの構文木; ソースと同時に書かれるので SourceStamp は空
+      ContentTop *top = new ContentTop(&symbols);
+      if (top->decodeCache(data, len, SourceStamp())) {
+        lp.ptype = PackageBase::PT_MINOSYS;
+        lp.top = top;
         return true;
       }
+      delete top;
+    }
+    if (ar->entry(pacname, Archive::SOURCE, buf, data, len)) {
+      // 本体はマッピング上のもの (または展開したもの) を複製せずに解析する
+      // マッピングは Engine が閉じるまで残る; 展開したものは読み飛ばした本体のために ContentTop に渡す
+      unique_ptr<LexBase> lex;
+      if (!buf.empty() && data == buf.data()) {
+        lex.reset(new LexBuffer(std::move(buf)));
+      } else {
+        lex.reset(new LexString(data, len));
+      }
+      ContentTop *top = new ContentTop(&symbols);
+      top->lazy = lazyParse;
+      if (top->yylex(std::move(lex))) {
+        // minosys script として認識
+        lp.ptype = PackageBase::PT_MINOSYS;
+        lp.top = top;
+        return true;
+      }
+      delete top;
     }
   }
 
@@ -950,85 +1644,128 @@ bool Engine::analyzePackage(const string &pacname, bool current) {
     string pt = *vp + "/" + pacname + ".minosys";
     void *d = dlopen(pt.c_str(), RTLD_LAZY);
     if (d) {
-      void *st = dlsym(d, "start");
-      if (st) {
+      if (dlsym(d, "start") || dlsym(d, "minosys_module_init")) {
         // binary package を発見
-        shared_ptr<PackageDlopen> pd = make_shared<PackageDlopen>();
-        pd->ptype = PackageBase::PT_DLOPEN;
-        pd->name = pacname;
-        pd->path = pt;
-        pd->dlhandle = d;
-        pd->eng = this;
-        packages[pacname] = dynamic_pointer_cast<PackageBase>(pd);
-        if (current) {
-          packages[""] = packages[pacname];
-        }
+        lp.ptype = PackageBase::PT_DLOPEN;
+        lp.path = pt;
+        lp.dlhandle = d;
         return true;
       }
       dlclose(d);
     }
     FILE *f = fopen(pt.c_str(), "r");
     if (f) {
-      LexFile lexf(f);
-      ContentTop *top = new ContentTop();
-      if (top->yylex(&lexf)) {
-        fclose(f);
-        // minosys script を発見
-        shared_ptr<PackageMinosys> pm = make_shared<PackageMinosys>();
-        pm->ptype = PackageBase::PT_MINOSYS;
-        pm->name = pacname;
-        pm->path = pt;
-        pm->top = top;
-        pm->eng = this;
-        packages[pacname] = dynamic_pointer_cast<PackageBase>(pm);
-        if (current) {
-          packages[""] = packages[pacname];
+      // ソースが変わっていなければキャッシュから構文木を復元する
+      SourceStamp st;
+      bool stamped = useCache && st.read(pt);
+      string cpt = pt + "c";
+      ContentTop *top = new ContentTop(&symbols);
+      bool parsed = stamped && top->loadCache(cpt, st);
+      if (!parsed) {
+        delete top;
+        top = new ContentTop(&symbols);
+        top->lazy = lazyParse;
+        unique_ptr<LexMap> lexm(new LexMap(pt));
+        if (lexm->valid()) {
+          parsed = top->yylex(std::move(lexm)) != NULL;
+        } else {
+          LexFile lexf(f);
+          parsed = top->yylex(&lexf) != NULL;
         }
-        for (auto vpac = top->imports.begin(); vpac != top->imports.end(); ++vpac) {
-          analyzePackage(*vpac);
+        if (parsed && stamped) {
+          // 書けなくても実行には影響しない; 本体を遅延解析した場合は書かない
+          top->saveCache(cpt, st);
         }
-        return true;
       }
       fclose(f);
+      if (parsed) {
+        // minosys script を発見
+        lp.ptype = PackageBase::PT_MINOSYS;
+        lp.path = pt;
+        lp.top = top;
+        return true;
+      }
+      delete top;
     }
   }
   return false;
 }
 
-shared_ptr<Var> Engine::start(const string &pname, const string &fname, vector<shared_ptr<Var> > &args) {
+// パッケージを登録する; current ならメインパッケージ ("") としても登録する
+void Engine::addPackage(const string &pacname, const shared_ptr<PackageBase> &pkg, bool current) {
+  packages[pacname] = pkg;
+  Symbol id = symbols.symbol(pacname);
+  if (packageIndex.size() <= id) {
+    packageIndex.resize(id + 1);
+  }
+  packageIndex[id] = pkg.get();
+  if (current) {
+    packages[""] = pkg;
+    packageIndex[0] = pkg.get();
+  }
+}
+
+VarPtr Engine::start(const string &pname, const string &fname, vector<VarPtr> &args) {
   auto p = packages.find(pname);
   if (p != packages.end()) {
     // カレントパッケージ名を設定する
-    string prevPackageName = this->currentPackageName;
-    this->currentPackageName = pname;
+    Symbol prevPackage = this->currentPackage;
+    this->currentPackage = symbols.symbol(pname);
 
     // パッケージ関数呼び出し
-    shared_ptr<Var> r = p->second->start(fname, args);
+    VarPtr r = p->second->start(symbols.symbol(fname), args);
 
     // カレントパッケージ名を復帰する
-    this->currentPackageName = prevPackageName;
+    this->currentPackage = prevPackage;
     return r;
   }
-  return make_shared<Var>();
+  return newVar();
+}
+
+// グローバル変数のスロット番号を返す; なければ割り当てる
+int Engine::globalSlot(Symbol vname) {
+  if (globalindex.size() <= vname) {
+    globalindex.resize(vname + 1, -1);
+  }
+  int &n = globalindex[vname];
+  if (n < 0) {
+    n = (int)globalvars.size();
+    globalvars.push_back(VarPtr());
+  }
+  return n;
+}
+
+// 名前による変数の検索
+VarPtr &Engine::searchVar(const string &vname, bool bLHS) {
+  Symbol id = symbols.symbol(vname);
+  int gslot = id < globalindex.size() ? globalindex[id] : -1;
+  return searchVar(id, -1, gslot, bLHS);
 }
 
-shared_ptr<Var> &Engine::searchVar(const string &vname, bool bLHS) {
+VarPtr &Engine::searchVar(Symbol vname, int slot, int gslot, bool bLHS) {
   // search block local
-  for (int i = vars.size() - 1; i >= varmark.back(); --i) {
-    unordered_map<string, shared_ptr<Var> > &map = vars[i];
-    auto p = map.find(vname);
-    if (p != map.end()) {
-      return p->second;
+  if (slot >= 0) {
+    VarPtr &v = frames.back()[slot];
+    if (v) {
+      return v;
+    }
+  } else {
+    for (int i = vars.size() - 1; i >= varmark.back(); --i) {
+      unordered_map<Symbol, VarPtr> &map = vars[i];
+      auto p = map.find(vname);
+      if (p != map.end()) {
+        return p->second;
+      }
     }
   }
 
   // search instance variable
   if (vars.size() - 1 >= varmark.back()) {
-    unordered_map<string, shared_ptr<Var> > &map = vars[varmark.back()];
-    auto p = map.find("this");
+    unordered_map<Symbol, VarPtr> &map = vars[varmark.back()];
+    auto p = map.find(symThis);
     if (p != map.end()) {
       // instance found
-      Instance *inst = p->second->inst.get();
+      Instance *inst = p->second->inst();
       auto pi = inst->vars.find(vname);
       if (pi != inst->vars.end()) {
         return pi->second;
@@ -1037,19 +1774,22 @@ shared_ptr<Var> &Engine::searchVar(const string &vname, bool bLHS) {
   }
 
   // search global variables
-  auto pg = globalvars.find(vname);
-  if (pg != globalvars.end()) {
-    return pg->second;
+  if (gslot >= 0 && globalvars[gslot]) {
+    return globalvars[gslot];
   }
 
   if (bLHS) {
     // create a new local variable 
-    unordered_map<string, shared_ptr<Var> > &map = vars[varmark.back()];
-    map[vname] = make_shared<Var>();
+    if (slot >= 0) {
+      VarPtr &v = frames.back()[slot];
+      v = newVar();
+      return v;
+    }
+    unordered_map<Symbol, VarPtr> &map = vars[varmark.back()];
+    map[vname] = newVar();
     return map[vname];
   }
 
   // 未定義の変数を使用した
-  throw RuntimeException(901, string("undefined variable:") + vname);
+  throw RuntimeException(901, string("undefined variable:") + symbols.name(vname));
 }
-
@@ -2,57 +2,148 @@
 
 #include <vector>
 #include <stack>
+#include <deque>
 #include <unordered_map>
 #include <string>
 #include <cstdio>
+#include <cstring>
 #include <memory>
+#include <functional>
+#include <mutex>
+#include <cstdint>
 #include "content.h"
+#include "flatmap.h"
 
 namespace minosys {
 
 class Instance;
-enum VTYPE {
+struct Var;
+struct ByteCode;
+enum VTYPE : uint8_t {
   VT_NULL, VT_INT, VT_DNUM, VT_STRING, VT_INST, VT_POINTER, VT_ARRAY, VT_FUNC, VT_MEMBER
 };
 
+// 参照カウント付きのポインタ
+// 1 つの Engine は 1 スレッドで動作するため、カウントは atomic にしない
+// T は int refcount を持ち、delete で解放できること
+template<class T> class Ref {
+ public:
+  Ref() : p(NULL) {}
+  explicit Ref(T *p) : p(p) { if (p) ++p->refcount; }
+  Ref(const Ref &r) : p(r.p) { if (p) ++p->refcount; }
+  Ref(Ref &&r) : p(r.p) { r.p = NULL; }
+  ~Ref() { release(); }
+  Ref &operator = (const Ref &r) {
+    if (r.p) ++r.p->refcount;
+    release();
+    p = r.p;
+    return *this;
+  }
+  Ref &operator = (Ref &&r) {
+    if (this != &r) {
+      release();
+      p = r.p;
+      r.p = NULL;
+    }
+    return *this;
+  }
+  T *operator -> () const { return p; }
+  T &operator * () const { return *p; }
+  T *get() const { return p; }
+  explicit operator bool () const { return p != NULL; }
+  bool operator == (const Ref &r) const { return p == r.p; }
+  bool operator != (const Ref &r) const { return p != r.p; }
+  void reset() { release(); p = NULL; }
+
+ private:
+  T *p;
+  void release() { if (p && --p->refcount == 0) delete p; }
+};
+
+typedef Ref<Var> VarPtr;
+
+// Var 用の固定長ブロックの freelist; スレッドごとに持つ
+class VarPool {
+ public:
+  enum { BLOCKSIZE = 16, CHUNK = 1024 };
+  static void *alloc(size_t size);
+  static void free(void *p, size_t size);
+  static thread_local size_t allocs;	// 払い出したブロック数
+  static thread_local size_t heapallocs;	// ヒープから確保した回数
+
+ private:
+  struct Block { Block *next; };
+  static thread_local Block *freelist;
+};
+
+// 長い文字列の添字; 複製した VarKey の間で共有し、hash 値は作成時に求めておく
+struct KeyString {
+  int refcount;
+  uint32_t len;
+  size_t hash;
+  char data[1];
+  static KeyString *create(const char *s, size_t len, size_t hash);
+  void release() { if (--refcount == 0) ::operator delete(this); }
+};
+
+// 文字列の hash (FNV-1a)
+inline size_t hashString(const char *s, size_t len) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; ++i) {
+    h = (h ^ (uint8_t)s[i]) * 0x100000001b3ULL;
+  }
+  return (size_t)h;
+}
+
+// 配列の添字
+// SHORTLEN バイトまでの文字列は確保せずにそのまま持つ
 struct VarKey {
+  enum { SHORTLEN = 16, LONG = 0xff };
   VTYPE vtype;
+  uint8_t slen;	// VT_STRING の短い文字列の長さ; LONG なら u.lstr
   union {
     int inum;
     double dnum;
-    std::string *str;
+    char sbuf[SHORTLEN];
+    KeyString *lstr;
   } u;
-  VarKey() : vtype(VT_INT) {}
-  VarKey(int inum) : vtype(VT_INT) {
+  VarKey() : vtype(VT_INT), slen(0) {}
+  VarKey(int inum) : vtype(VT_INT), slen(0) {
     u.inum = inum;
   }
-  VarKey(double dnum) : vtype(VT_DNUM) {
+  VarKey(double dnum) : vtype(VT_DNUM), slen(0) {
     u.dnum = dnum;
   }
   VarKey(const std::string &s) : vtype(VT_STRING) {
-    u.str = new std::string(s);
-  }
-  VarKey(const VarKey &k) : vtype(k.vtype) {
-    switch (vtype) {
-    case VT_INT:
-      u.inum = k.u.inum;
-      break;
-
-    case VT_DNUM:
-      u.dnum = k.u.dnum;
-      break;
-
-    case VT_STRING:
-      u.str = new std::string(*k.u.str);
-      break;
+    if (s.size() <= SHORTLEN) {
+      slen = (uint8_t)s.size();
+      memcpy(u.sbuf, s.data(), s.size());
+    } else {
+      slen = LONG;
+      u.lstr = KeyString::create(s.data(), s.size(), hashString(s.data(), s.size()));
     }
   }
+  VarKey(const VarKey &k) : vtype(k.vtype), slen(k.slen), u(k.u) {
+    if (isLong()) ++u.lstr->refcount;
+  }
+  VarKey(VarKey &&k) : vtype(k.vtype), slen(k.slen), u(k.u) {
+    k.vtype = VT_INT;
+  }
   ~VarKey() {
-    if (vtype == VT_STRING) delete u.str;
+    if (isLong()) u.lstr->release();
   }
+  bool isLong() const { return vtype == VT_STRING && slen == LONG; }
+  // VT_STRING の内容
+  const char *data() const { return isLong() ? u.lstr->data : u.sbuf; }
+  size_t length() const { return isLong() ? u.lstr->len : slen; }
   bool operator == (const VarKey &k) const;
   bool operator != (const VarKey &k) const;
+  bool operator == (const std::string &s) const {
+    return vtype == VT_STRING && length() == s.size() && memcmp(data(), s.data(), s.size()) == 0;
+  }
   std::string toString() const;
+
+  // std::string のまま検索できるよう、同じ内容なら同じ hash 値を返す
   struct Hash {
     size_t operator()(const VarKey &v) const {
       switch(v.vtype) {
@@ -63,49 +154,193 @@ struct VarKey {
         return std::hash<double>()(v.u.dnum);
 
       case VT_STRING:
-        return std::hash<std::string>()(*v.u.str);
+        return v.isLong() ? v.u.lstr->hash : hashString(v.u.sbuf, v.slen);
       }
       return 0;
     }
+    size_t operator()(const std::string &s) const {
+      return hashString(s.data(), s.size());
+    }
   };
+  struct Equal {
+    bool operator()(const VarKey &a, const VarKey &b) const { return a == b; }
+    bool operator()(const VarKey &a, const std::string &b) const { return a == b; }
+  };
+
+ private:
+  VarKey &operator = (const VarKey &);
+};
+
+// 配列の実体
+// 0 から連続する整数の添字の要素は list に、それ以外の添字は hash に置く
+// list の次の添字が追加されると、hash にある続きの要素も list へ移す
+// 要素は削除されないので、list は常に 0 から連続する最長の範囲になる
+class VarArray {
+ public:
+  int refcount;	// 実体を共有する Var の数
+  VarArray() : refcount(0) {}
+  VarArray(const VarArray &a) : refcount(0), list(a.list), hash(a.hash) {}
+  typedef FlatMap<VarKey, VarPtr, VarKey::Hash, VarKey::Equal> Hash;
+  bool empty() const { return list.empty() && hash.empty(); }
+  size_t size() const { return list.size() + hash.size(); }
+
+  // 要素を探す; なければ NULL
+  const VarPtr *find(int i) const {
+    if (i >= 0 && (size_t)i < list.size()) return &list[i];
+    return hash.empty() ? NULL : findHash(VarKey(i));
+  }
+  const VarPtr *find(const VarKey &key) const {
+    return key.vtype == VT_INT ? find(key.u.inum) : findHash(key);
+  }
+  const VarPtr *find(const std::string &key) const;
+
+  // 要素を返す; なければ null の要素を作成する
+  // 返した参照は次に要素を追加するまで有効
+  VarPtr &at(int i) {
+    if (i >= 0 && (size_t)i < list.size()) return list[i];
+    return insert(i);
+  }
+  VarPtr &at(const VarKey &key) {
+    return key.vtype == VT_INT ? at(key.u.inum) : atHash(key);
+  }
+  VarPtr &at(const std::string &key);
+
+  bool operator == (const VarArray &a) const { return list == a.list && hash == a.hash; }
+  const std::vector<VarPtr> &listPart() const { return list; }
+  const Hash &hashPart() const { return hash; }
+
+ private:
+  std::vector<VarPtr> list;	// 添字 0..list.size()-1
+  Hash hash;
+  const VarPtr *findHash(const VarKey &key) const;
+  VarPtr &atHash(const VarKey &key);
+  VarPtr &insert(int i);
+};
+// 文字列の実体; 配列の実体と同じく複製した Var の間で共有する
+// 長い文字列の後ろに連結すると、左側の実体を prefix として参照し、右側だけを s に持つ
+// 内容は読み出すときに一本の文字列へまとめる
+struct VarString {
+  enum { ROPEMIN = 256 };	// これより短い文字列への連結はその場で複製する
+  int refcount;
+  size_t plen;	// prefix の長さ
+  VarString *prefix;	// NULL なら s が内容のすべて
+  std::string s;
+  explicit VarString(const std::string &s) : refcount(1), plen(0), prefix(NULL), s(s) {}
+  VarString(VarString *prefix, const char *p, size_t n);
+  size_t size() const { return plen + s.size(); }
+  const std::string &str() {
+    if (prefix) flatten();
+    return s;
+  }
+  void flatten();
+  void compact();
+  // 参照を外す; 連結の鎖は再帰せずに解放する
+  static void release(VarString *p);
+
+ private:
+  VarString(const VarString &);
+  VarString &operator = (const VarString &);
+};
+
+// 関数値; package が 0 の場合はカレントパッケージの関数
+struct FuncRef {
+  Symbol package;
+  Symbol name;
+  bool operator == (const FuncRef &f) const { return package == f.package && name == f.name; }
 };
+typedef std::pair<VarPtr, Symbol> MemberPair;
 
+// 値; 整数・実数・null は即値、それ以外は別に確保した実体へのポインタを持つ
 struct Var {
   VTYPE vtype;
-  int inum;
-  double dnum;
-  std::string str;
-  std::pair<std::string, std::string> func;
-  std::pair<std::shared_ptr<Var>, std::string> member;
-  std::shared_ptr<Instance> inst;
-  void *pointer;
-  std::unordered_map<VarKey, std::shared_ptr<Var>, VarKey::Hash> arrayhash;
-
-  Var() : vtype(VT_NULL) {}
-  Var(int inum) : vtype(VT_INT) { this->inum = inum; }
-  Var(double dnum) : vtype(VT_DNUM) { this->dnum = dnum; }
-  Var(const std::string &c) : vtype(VT_STRING),  str(c) {}
-  Var(Instance *i) : vtype(VT_INST), inst(i) {}
-  Var(const std::shared_ptr<Instance> &i) : vtype(VT_INST), inst(i) {}
-  Var(const std::pair<std::string, std::string> &fnpair) : vtype(VT_FUNC), func(fnpair) {}
-  Var(const std::pair<std::shared_ptr<Var>, std::string> &mpair) : vtype(VT_MEMBER), member(mpair) {}
-  Var(const std::unordered_map<VarKey, std::shared_ptr<Var>, VarKey::Hash> ah) : vtype(VT_ARRAY), arrayhash(ah) {}
+  bool constant;	// 読み込み時に作成したリテラル; 変数には複製して束縛する
+  int refcount;
+  union {
+    int inum;
+    double dnum;
+    void *pointer;
+    VarString *pstr;
+    Instance *pinst;
+    VarArray *parray;
+    FuncRef fn;
+    MemberPair *pmember;
+  };
+
+  Var() : vtype(VT_NULL), constant(false), refcount(0), pointer(NULL) {}
+  Var(int inum) : vtype(VT_INT), constant(false), refcount(0), dnum(0) { this->inum = inum; }
+  Var(double dnum) : vtype(VT_DNUM), constant(false), refcount(0), dnum(dnum) {}
+  Var(const std::string &c) : vtype(VT_STRING), constant(false), refcount(0), pstr(new VarString(c)) {}
+  Var(Instance *i);
+  Var(const FuncRef &f) : vtype(VT_FUNC), constant(false), refcount(0), fn(f) {}
+  Var(const MemberPair &mpair) : vtype(VT_MEMBER), constant(false), refcount(0), pmember(new MemberPair(mpair)) {}
+  Var(const VarArray &a) : vtype(VT_ARRAY), constant(false), refcount(0), parray(new VarArray(a)) { ++parray->refcount; }
   Var(const Var &v);
-  ~Var();
+  ~Var() { release(); }
   Var &operator = (const Var &v);
   bool operator == (const Var &v) const;
-  std::shared_ptr<Var> clone();
+  VarPtr clone();
   bool isTrue() const;
+
+  // 型を変更する; 以前の実体は解放し、新しい型の空の実体を作成する
+  void settype(VTYPE t);
+  void setString(const std::string &s);
+
+  // 文字列と配列の実体は複製した Var の間で共有する (copy on write)
+  // 書き込むときは mutableStr()/mutableArray() で自分だけの実体にしてから参照を得る
+  const std::string &str() const { return pstr->str(); }
+  size_t strSize() const { return pstr->size(); }
+  std::string &mutableStr() {
+    if (pstr->prefix) pstr->flatten();
+    if (pstr->refcount > 1) unshare();
+    return pstr->s;
+  }
+  // 文字列の後ろに追加する; 共有している長い文字列はまとめずに連結する
+  void appendStr(const char *p, size_t n);
+  void appendStr(const std::string &s) { appendStr(s.data(), s.size()); }
+  // 文字列の後ろに連結した新しい値を返す
+  VarPtr concat(const char *p, size_t n) const;
+  VarPtr concat(const std::string &s) const { return concat(s.data(), s.size()); }
+  Instance *inst() const { return pinst; }
+  const VarArray &array() const { return *parray; }
+  VarArray &mutableArray() {
+    if (parray->refcount > 1) unshare();
+    return *parray;
+  }
+  FuncRef &func() { return fn; }
+  const FuncRef &func() const { return fn; }
+  MemberPair &member() { return *pmember; }
+  const MemberPair &member() const { return *pmember; }
+
+  // Var 本体は freelist から確保する
+  static void *operator new (size_t size) { return VarPool::alloc(size); }
+  static void operator delete (void *p, size_t size) { VarPool::free(p, size); }
+
+ private:
+  void release();
+  void copyFrom(const Var &v);
+  void unshare();
 };
+static_assert(sizeof(Var) == 16, "Var must stay 16 bytes");
+
+// Var の作成
+template<class... A> VarPtr newVar(A&&... a) {
+  return VarPtr(new Var(std::forward<A>(a)...));
+}
+
+// 変数に束縛する値; 定数は共有せず複製する
+inline VarPtr bindVar(const VarPtr &v) {
+  return v->constant ? newVar(*v) : v;
+}
 
 class Instance {
   friend Var;
 
  public:
+  int refcount;
   MinosysClassDef *def;
-  std::unordered_map<std::string, std::shared_ptr<Var> > vars;
-  Instance() : def(NULL) {}
-  Instance(const Instance &i) : def(i.def), vars(i.vars) {}
+  FlatMap<Symbol, VarPtr> vars;
+  Instance() : refcount(0), def(NULL) {}
+  Instance(const Instance &i) : refcount(0), def(i.def), vars(i.vars) {}
 };
 
 class Engine;
@@ -117,19 +352,56 @@ class PackageBase {
    Engine *eng;
    std::string name;
    std::string path;
-   virtual std::shared_ptr<Var> start(const std::string &fname, std::vector<std::shared_ptr<Var> > &args) = 0;
+   virtual VarPtr start(Symbol fname, std::vector<VarPtr> &args) = 0;
    virtual ~PackageBase() {}
 };
 
+class PackageDlopen : public PackageBase {
+ public:
+  enum { MAXFASTARGS = 8 };	// これより多い引数は vector を経由して呼ぶ
+
+  // 関数名の呼び出し先; dlsym の結果は名前ごとに一度だけ引いて記憶する
+  struct Native {
+    enum KIND : uint8_t {
+      UNRESOLVED = 0,
+      MISSING,	// 関数がない
+      START,	// start と同じ形式
+      FAST	// minosys_module_init で登録された関数
+    } kind;
+    int nargs;
+    void *func;
+    Native() : kind(UNRESOLVED), nargs(-1), func(NULL) {}
+  };
+
+  void *dlhandle;
+  PackageDlopen() : dlhandle(NULL) {}
+  void init();
+  VarPtr start(Symbol fname, std::vector<VarPtr> &args);
+  const Native *fast(Symbol fname) const {
+    return fname < natives.size() && natives[fname].kind == Native::FAST ? &natives[fname] : NULL;
+  }
+  VarPtr callFast(const Native &n, Symbol fname, void *const *args, int nargs);
+  ~PackageDlopen();
+
+ private:
+  std::vector<Native> natives;	// 関数名の Symbol で引く
+  Native &native(Symbol fname) {
+    if (fname >= natives.size()) natives.resize(fname + 1);
+    return natives[fname];
+  }
+};
+
 class PackageMinosys : public PackageBase {
  private:
-   std::shared_ptr<Var> eval_var(Content *c);
-   std::shared_ptr<Var> eval_functag(Content *c);
-   std::shared_ptr<Var> eval_func(Content *c);
-   std::shared_ptr<Var> eval_op(Content *c);
+   VarPtr eval_var(Content *c);
+   VarPtr eval_functag(Content *c);
+   VarPtr eval_func(Content *c);
+   VarPtr eval_op(Content *c);
 
-   std::unordered_map<std::string, std::function<std::shared_ptr<Var>(PackageMinosys *, Content *)> > opmap;
-#define OP(x) std::shared_ptr<Var> eval_op_##x(Content *c);
+   // OpType で引く演算子の評価関数
+   typedef VarPtr (PackageMinosys::*OpFunc)(Content *c);
+   static const OpFunc optable[OT_MAX];
+#define OP(x) VarPtr eval_op_##x(Content *c);
 
    OP(dot);
    OP(3term);
@@ -171,18 +443,64 @@ class PackageMinosys : public PackageBase {
    OP(rsh);
    OP(leftarray);
 
-   std::shared_ptr<Var>& createVar(const std::string &vname, std::vector<Content *> &pc);
-   std::shared_ptr<Var>* createVarIndex(const VarKey &key, std::shared_ptr<Var> *pv);
+   // 評価済みの値に対する演算; tree walker と bytecode VM で共用する
+#define CALC1(x) VarPtr calc_##x(const VarPtr &v);
+#define CALC2(x) VarPtr calc_##x(const VarPtr &v1, const VarPtr &v2);
+#define CALCLHS(x) VarPtr calc_##x(VarPtr &v);
+#define CALCASSIGN(x) VarPtr calc_##x(VarPtr &v1, const VarPtr &v2);
+
+   CALC1(monoNot);
+   CALC1(negate);
+   CALC1(monoMinus);
+   CALCASSIGN(assignplus);
+   CALCASSIGN(assignminus);
+   CALCASSIGN(assignmultiply);
+   CALCASSIGN(assigndiv);
+   CALCASSIGN(assignmod);
+   CALCASSIGN(assignand);
+   CALCASSIGN(assignor);
+   CALCASSIGN(assignxor);
+   CALCASSIGN(assignlsh);
+   CALCASSIGN(assignrsh);
+   CALCLHS(preIncr);
+   CALCLHS(postIncr);
+   CALCLHS(preDecr);
+   CALCLHS(postDecr);
+   CALC2(lt);
+   CALC2(lteq);
+   CALC2(gt);
+   CALC2(gteq);
+   CALC2(neq);
+   CALC2(eq);
+   CALC2(plus);
+   CALC2(minus);
+   CALC2(multiply);
+   CALC2(div);
+   CALC2(mod);
+   CALC2(and);
+   CALC2(or);
+   CALC2(xor);
+   CALC2(lsh);
+   CALC2(rsh);
+
+   bool findIndex(VarPtr &v, const VarPtr &a);
+   void prepareCall(VarPtr &func, std::vector<VarPtr> &args);
+   VarPtr invoke(const VarPtr &func, std::vector<VarPtr> &args);
+   VarPtr invokeFast(PackageDlopen *pd, const PackageDlopen::Native &n, const FuncRef &f, const VarPtr *args, int nargs);
+   VarPtr& createVar(Content *lhs);
+   VarPtr& createVar(Content *lhs, const VarPtr *idx, int nidx);
+   VarPtr& createVar(Content *lhs, Content *rhs, VarPtr &v2);
+   VarPtr* createVarIndex(const VarKey &key, VarPtr *pv);
    std::string createMulString(int count, const std::string &s);
 
  public:
    ContentTop *top;
-   std::shared_ptr<Var> start(const std::string &fname, std::vector<std::shared_ptr<Var> > &args);
+   VarPtr start(Symbol fname, std::vector<VarPtr> &args);
 
-   std::unordered_map<std::string, std::function<std::shared_ptr<Var>(PackageMinosys *, std::vector<std::shared_ptr<Var> >)> > builtinmap;
-   std::unordered_map<std::string, std::function<std::shared_ptr<Var>(PackageMinosys *, std::vector<std::shared_ptr<Var> >)> > stringmap;
+   std::unordered_map<Symbol, std::function<VarPtr(PackageMinosys *, const std::vector<VarPtr> &)> > builtinmap;
+   std::unordered_map<Symbol, std::function<VarPtr(PackageMinosys *, const std::vector<VarPtr> &)> > stringmap;
 
-#define BUILTIN(bb) std::shared_ptr<Var> func##bb (const std::vector<std::shared_ptr<Var> > &args)
+#define BUILTIN(bb) VarPtr func##bb (const std::vector<VarPtr> &args)
    BUILTIN(type);
    BUILTIN(convert);
    BUILTIN(print);
@@ -195,57 +513,122 @@ class PackageMinosys : public PackageBase {
    BUILTIN(rindex);
    BUILTIN(substr);
 
-   std::shared_ptr<Var> callfunc(const std::string &fname, Content *c);
-   std::shared_ptr<Var> evaluate(Content *c);
-   PackageMinosys();
+   std::unordered_map<Symbol, ByteCode *> codes;
+   std::unordered_map<std::string, std::unordered_map<std::string, ByteCode *> > memberCodes;
+   std::vector<VarPtr> consts;	// リテラル定数; Content::slot で参照する
+   void resolve();
+   void compile();
+   void parseBody(Symbol fname, Content *def);
+   VarPtr execute(ByteCode *bc);
+   VarPtr callfunc(Content *c);
+   Content *nextStatement(Content *c);
+   Content *unwindLoop(Content *c);
+   VarPtr evaluate(Content *c);
+   PackageMinosys(Engine *eng);
    ~PackageMinosys();
 };
 
-class PackageDlopen : public PackageBase {
- public:
-  void *dlhandle;
-  std::shared_ptr<Var> start(const std::string &fname, std::vector<std::shared_ptr<Var> > &args);
-  ~PackageDlopen();
-};
-
 class Engine {
  public:
-  struct Archive {
-    std::FILE *f;
-    std::unordered_map<std::string, std::pair<int, int> > map;
-    std::string findMap(const std::string &name);
-    void createMap();
-
+  // mmap した mpk2 アーカイブ
+  // 形式: "mpk2", 要素数 (int), Elem の表, キーと本体 (位置はファイル先頭から)
+  // 要素表とパッケージ本体はマッピング上のものをそのまま参照する
+  //
+  // キーはパッケージ名で、本体はソース
+  // minosysar が作るアーカイブは名前に次の接尾辞を付けた要素も持つことがある
+  //   "\0c": 事前コンパイル済みの構文木 (ContentTop::encodeCache の形式)
+  //   "\0z", "\0cz": zlib で圧縮したソースまたは構文木; 先頭 4 バイトは展開後の長さ
+  class Archive {
+   public:
     struct Elem {
-      int key_offset, key_length;
-      int val_offset, val_length;
+      int32_t key_offset, key_length;
+      int32_t val_offset, val_length;
     };
-    ~Archive() {
-      if (f) {
-        std::fclose(f);
-      }
+    enum Kind { SOURCE, COMPILED };
+    static std::string key(const std::string &name, Kind kind, bool compressed);
+    Archive() : map(NULL), maplen(0), elems(NULL), nelem(0) {}
+    ~Archive();
+    bool open(const std::string &path);	// mpk2 でなければ false
+    bool find(const std::string &name, const char *&data, size_t &len) const;
+    bool entry(const std::string &name, Kind kind, std::string &buf, const char *&data, size_t &len) const;
+    size_t size() const { return nelem; }
+
+   private:
+    void *map;
+    size_t maplen;
+    const Elem *elems;
+    uint32_t nelem;
+    std::vector<uint32_t> order;	// キー順の添字; 要素表が整列済みなら空
+    TokenText key(uint32_t i) const {
+      return TokenText((const char *)map + elems[i].key_offset, elems[i].key_length);
     }
+    bool less(uint32_t a, uint32_t b) const;
+    Archive(const Archive &);
+    Archive &operator = (const Archive &);
   };
   Archive *ar;
+  SymbolTable symbols;	// 全パッケージの識別子; 構文木より長く生存する
   std::vector<std::string> searchPaths;
   std::unordered_map<std::string, std::shared_ptr<PackageBase> > packages;
-  std::unordered_map<std::string, std::shared_ptr<Var> > globalvars;
-  std::vector<std::unordered_map<std::string, std::shared_ptr<Var> > > vars;
+  std::vector<PackageBase *> packageIndex;	// パッケージ名の Symbol で引く
+  std::vector<int> globalindex;	// 変数名の Symbol からグローバルスロット; -1 は未割り当て
+  std::deque<VarPtr> globalvars;
+  std::vector<VarPtr *> frames;
+  std::vector<std::unordered_map<Symbol, VarPtr> > vars;
   std::vector<int> varmark;
-  std::vector<std::shared_ptr<Var> > paramstack;
+  std::vector<VarPtr> paramstack;
   std::vector<int> topmark;
   std::vector<Content *> callstack;
   std::vector<int> callmark;
   std::vector<std::pair<std::string, std::string> > headers;
-  std::string currentPackageName;
-  Engine(const std::vector<std::string> &searchPaths) : searchPaths(searchPaths), ar(NULL) {}
+  Symbol currentPackage;
+  Symbol symThis;	// "this"
+  bool useBytecode;	// false の場合は tree walker で実行する
+  bool useCache;	// 構文解析の結果を <package>.minosysc に保存・再利用する
+  bool lazyParse;	// 関数本体は最初に呼ばれた時に構文解析する
+  int loaderThreads;	// import を読み込むスレッド数; 0 はコア数
+  Engine(const std::vector<std::string> &searchPaths);
   ~Engine();
   bool analyzePackage(const std::string &pacname, bool current = false);
   void setArchive(const std::string &arname);
-  std::shared_ptr<Var> start(const std::string &pname, const std::string &fname, std::vector<std::shared_ptr<Var> > &args);
-  std::shared_ptr<Var> &searchVar(const std::string &vname, bool bLHS = false);
+  VarPtr start(const std::string &pname, const std::string &fname, std::vector<VarPtr> &args);
+  void addPackage(const std::string &pacname, const std::shared_ptr<PackageBase> &pkg, bool current);
+  PackageBase *findPackage(Symbol pname) const {
+    return pname < packageIndex.size() ? packageIndex[pname] : NULL;
+  }
+  int globalSlot(Symbol vname);
+
+  // f が高速呼び出し ABI のネイティブ関数ならその呼び出し先を返す
+  const PackageDlopen::Native *findFast(const FuncRef &f, PackageDlopen *&pd) const {
+    PackageBase *base = findPackage(f.package ? f.package : currentPackage);
+    if (!base || base->ptype != PackageBase::PT_DLOPEN) return NULL;
+    pd = static_cast<PackageDlopen *>(base);
+    return pd->fast(f.name);
+  }
+  VarPtr &searchVar(const std::string &vname, bool bLHS = false);
+  VarPtr &searchVar(Symbol vname, int slot, int gslot, bool bLHS);
+
+  // 解決済みの変数参照; ローカルスロットに値があればそのまま返す
+  VarPtr &searchVar(Content *c, bool bLHS = false) {
+    if (c->slot >= 0) {
+      VarPtr &v = frames.back()[c->slot];
+      if (v) return v;
+    }
+    return searchVar(c->op.id(), c->slot, c->gslot, bLHS);
+  }
 
  private:
+  // 別スレッドで読み込んだパッケージ; 登録はメインスレッドで行う
+  struct LoadedPackage {
+    PackageBase::PTYPE ptype;
+    ContentTop *top;
+    void *dlhandle;
+    std::string path;
+    LoadedPackage() : ptype(PackageBase::PT_MINOSYS), top(NULL), dlhandle(NULL) {}
+  };
+  bool loadPackage(const std::string &pacname, LoadedPackage &lp);
+  void loadImports(const std::string &pacname, std::unordered_map<std::string, LoadedPackage> &loaded);
+  void registerPackage(const std::string &pacname, std::unordered_map<std::string, LoadedPackage> &loaded, bool current);
    void analyzeArchive(FILE *f);
 };
 
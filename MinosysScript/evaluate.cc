@@ -10,19 +10,23 @@ using namespace std;
 using namespace minosys;
 
 // 式の評価
-shared_ptr<Var> PackageMinosys::evaluate(Content *c) {
+VarPtr PackageMinosys::evaluate(Content *c) {
   switch (c->tag) {
   case LexBase::LT_NULL:	// nullptr
-    return make_shared<Var>();
+    if (c->slot >= 0) return consts[c->slot];
+    return newVar();
 
   case LexBase::LT_INT:	// 整数
-    return make_shared<Var>(c->inum);
+    if (c->slot >= 0) return consts[c->slot];
+    return newVar(c->inum);
 
   case LexBase::LT_DNUM:	// 浮動小数点
-    return make_shared<Var>(c->dnum);
+    if (c->slot >= 0) return consts[c->slot];
+    return newVar(c->dnum);
 
   case LexBase::LT_STRING:	// 文字列
-    return make_shared<Var>(c->op);
+    if (c->slot >= 0) return consts[c->slot];
+    return newVar(c->op);
 
   case LexBase::LT_VAR:	// 変数
     return eval_var(c);
@@ -37,187 +41,196 @@ shared_ptr<Var> PackageMinosys::evaluate(Content *c) {
     return eval_op(c);
 
   default:
-    cout << "unknown operator: (" << (int)c->tag << ")" << c->op << endl;
+    cout << "unknown operator: (" << (int)c->tag << ")" << c->op.str() << endl;
   }
-  return make_shared<Var>();
+  return newVar();
 }
 
 // 変数値の評価
-shared_ptr<Var> PackageMinosys::eval_var(Content *c) {
-  shared_ptr<Var> v = eng->searchVar(c->op);
+VarPtr PackageMinosys::eval_var(Content *c) {
+  VarPtr v = eng->searchVar(c);
   for (auto p = c->pc.begin(); p != c->pc.end(); ++p) {
-    if (v->vtype == VT_ARRAY) {
-      shared_ptr<Var> a = evaluate(*p);
-      switch(a->vtype) {
-      case VT_INT:
-        {
-          VarKey vk(a->inum);
-          auto pv = v->arrayhash.find(vk);
-          if (pv != v->arrayhash.end()) {
-            v = pv->second;
-          }
-        }
-        break;
-
-      case VT_DNUM:
-        {
-          VarKey vk(a->dnum);
-          auto pv = v->arrayhash.find(vk);
-          if (pv != v->arrayhash.end()) {
-            v = pv->second;
-          }
-        }
-        break;
-
-      case VT_STRING:
-        {
-          VarKey vk(a->str);
-          auto pv = v->arrayhash.find(vk);
-          if (pv != v->arrayhash.end()) {
-            v = pv->second;
-          }
-        }
-        break;
-
-      default:
-        return v;
-      }
-    } else {
+    if (v->vtype != VT_ARRAY) {
+      break;
+    }
+    VarPtr a = evaluate(*p);
+    if (!findIndex(v, a)) {
       break;
     }
   }
   return v;
 }
 
+// 配列要素を検索し、見つかれば v を置き換える
+// 添字が int/dnum/string 以外の場合は false を返す
+bool PackageMinosys::findIndex(VarPtr &v, const VarPtr &a) {
+  if (v->vtype != VT_ARRAY) {
+    // 配列でなければ要素は存在しない
+    return a->vtype == VT_INT || a->vtype == VT_DNUM || a->vtype == VT_STRING;
+  }
+  const VarPtr *p = NULL;
+  switch (a->vtype) {
+  case VT_INT:
+    p = v->array().find(a->inum);
+    break;
+
+  case VT_DNUM:
+    p = v->array().find(VarKey(a->dnum));
+    break;
+
+  case VT_STRING:
+    p = v->array().find(a->str());
+    break;
+
+  default:
+    return false;
+  }
+  if (p) {
+    // 要素は配列 v が保持しているので、v を置き換える前に参照を取る
+    VarPtr e = *p;
+    v = std::move(e);
+  }
+  return true;
+}
+
 // 関数名の評価
 // 実際の関数呼び出しは eval_func で行われる
-shared_ptr<Var> PackageMinosys::eval_functag(Content *c) {
-  pair<string, string> func(eng->currentPackageName, c->op);
-  return make_shared<Var>(func);
+VarPtr PackageMinosys::eval_functag(Content *c) {
+  FuncRef func = { eng->currentPackage, c->op.id() };
+  return newVar(func);
 }
 
 // 関数呼び出し
-shared_ptr<Var> PackageMinosys::eval_func(Content *c) {
+VarPtr PackageMinosys::eval_func(Content *c) {
   // [0]: 関数名
-  shared_ptr<Var> func = evaluate(c->pc.at(0));
-  vector<shared_ptr<Var> > args;
+  VarPtr func = evaluate(c->pc.at(0));
+  int nargs = (int)c->pc.size() - 1;
+  if (func->vtype == VT_FUNC && nargs <= PackageDlopen::MAXFASTARGS) {
+    // 高速呼び出し ABI のネイティブ関数は引数の vector を作らずに呼ぶ
+    PackageDlopen *pd;
+    const PackageDlopen::Native *n = eng->findFast(func->func(), pd);
+    if (n) {
+      VarPtr a[PackageDlopen::MAXFASTARGS];
+      for (int i = 0; i < nargs; ++i) {
+        a[i] = evaluate(c->pc.at(i + 1));
+      }
+      return invokeFast(pd, *n, func->func(), a, nargs);
+    }
+  }
+  vector<VarPtr> args;
+  args.reserve(c->pc.size());
 
   // パッケージ名の抽出
+  prepareCall(func, args);
+
+  // [1~]: 引数
+  for (int i = 1; i < c->pc.size(); i++) {
+    args.push_back(evaluate(c->pc.at(i)));
+  }
+  return invoke(func, args);
+}
+
+// 呼び出し対象の確認
+// S.func() の場合は S を第一引数として args に積む
+void PackageMinosys::prepareCall(VarPtr &func, vector<VarPtr> &args) {
   if (func->vtype == VT_MEMBER) {
-    switch (func->member.first->vtype) {
+    switch (func->member().first->vtype) {
     case VT_INST:
       // TODO: メンバーの場合の抽出処理
       break;
     case VT_STRING:
       // S.func() は func(S, ...) と呼び出される
-      args.push_back(func->member.first);
-      func = make_shared<Var>(pair<string, string>("", func->member.second));
+      args.push_back(func->member().first);
+      FuncRef f = { 0, func->member().second };
+      func = newVar(f);
     }
   } else if (func->vtype != VT_FUNC) {
     throw RuntimeException(1000, "Function calls non-function");
   }
+}
 
-  // [1~]: 引数
-  for (int i = 1; i < c->pc.size(); i++) {
-    args.push_back(evaluate(c->pc.at(i)));
+// 関数の実行
+VarPtr PackageMinosys::invoke(const VarPtr &func, vector<VarPtr> &args) {
+  if (func->vtype != VT_FUNC) {
+    throw RuntimeException(1000, "Function calls non-function");
   }
-
-  string pname;
-  if (func->func.first.empty()) {
+  FuncRef f = func->func();
+  if (f.package == 0) {
     // カレントパッケージ
-    pname = eng->currentPackageName;
-  } else {
-    // 別のパッケージ
-    pname = func->func.first;
+    f.package = eng->currentPackage;
   }
-  auto found = eng->packages.find(pname);
-  if (found == eng->packages.end()) {
-    throw RuntimeException(1001, string("Package not found:") + pname);
+  PackageBase *base = eng->findPackage(f.package);
+  if (!base) {
+    throw RuntimeException(1001, string("Package not found:") + eng->symbols.name(f.package));
   }
-  shared_ptr<PackageBase> base = found->second;
 
   // 関数呼び出しおよび結果の返却
-  string oldpname = eng->currentPackageName;
-  eng->currentPackageName = pname;
-  shared_ptr<Var> r = base->start(func->func.second, args);
-  eng->currentPackageName = oldpname;
+  Symbol oldpackage = eng->currentPackage;
+  eng->currentPackage = f.package;
+  VarPtr r = base->start(f.name, args);
+  eng->currentPackage = oldpackage;
+  return r;
+}
+
+// 高速呼び出し ABI のネイティブ関数の実行
+VarPtr PackageMinosys::invokeFast(PackageDlopen *pd, const PackageDlopen::Native &n, const FuncRef &f, const VarPtr *args, int nargs) {
+  void *argv[PackageDlopen::MAXFASTARGS];
+  for (int i = 0; i < nargs; ++i) {
+    argv[i] = args[i].get();
+  }
+  Symbol oldpackage = eng->currentPackage;
+  if (f.package) {
+    eng->currentPackage = f.package;
+  }
+  VarPtr r = pd->callFast(n, f.name, argv, nargs);
+  eng->currentPackage = oldpackage;
   return r;
 }
 
 // 演算子の評価
-shared_ptr<Var> PackageMinosys::eval_op(Content *c) {
-  auto p = opmap.find(c->op);
-  if (p != opmap.end()) {
-    return (p->second)(this, c);
+VarPtr PackageMinosys::eval_op(Content *c) {
+  OpFunc f = optable[c->opcode];
+  if (f) {
+    return (this->*f)(c);
   }
   throw RuntimeException(1002, string("operator not defined:") + c->op);
 }
 
 // ドット演算子
-shared_ptr<Var> PackageMinosys::eval_op_dot(Content *c) {
+VarPtr PackageMinosys::eval_op_dot(Content *c) {
   // TODO: LT_VAR の場合はインスタンスであることを確認する
-  // ここでは [package|eval].func という形式のみ考慮する
+  // ここでは [package|eval].func() という形式のみ考慮する
   Content *pac = c->pc.at(0);
   Content *fname = c->pc.at(1);
   if (pac->tag == LexBase::LT_TAG && fname->tag == LexBase::LT_TAG) {
-    return make_shared<Var>(pair<string, string>(pac->op, fname->op));
+    FuncRef f = { pac->op.id(), fname->op.id() };
+    return newVar(f);
   }
-  shared_ptr<Var> vp = evaluate(c->pc.at(0));
+  VarPtr vp = evaluate(c->pc.at(0));
   if (fname->tag == LexBase::LT_TAG) {
-    return make_shared<Var>(pair<shared_ptr<Var>, string>(vp, fname->op));
+    return newVar(MemberPair(vp, fname->op.id()));
   }
   throw new RuntimeException(1004, "illegal format for package or function");
 }
 
 // 左 array 演算子
-shared_ptr<Var> PackageMinosys::eval_op_leftarray(Content *c) {
-  shared_ptr<Var> v = evaluate(c->pc.at(0));
+VarPtr PackageMinosys::eval_op_leftarray(Content *c) {
+  VarPtr v = evaluate(c->pc.at(0));
   for (int i = 1; i < c->pc.size(); ++i) {
     if (v->vtype != VT_ARRAY) {
       break;
     }
-    shared_ptr<Var> a = evaluate(c->pc.at(i));
-    switch (a->vtype) {
-    case VT_INT:
-      {
-        VarKey vk(a->inum);
-        auto p = v->arrayhash.find(vk);
-        if (p != v->arrayhash.end()) {
-          v = p->second;
-        }
-      }
+    VarPtr a = evaluate(c->pc.at(i));
+    if (!findIndex(v, a)) {
       break;
-
-    case VT_DNUM:
-      {
-        VarKey vk(a->dnum);
-        auto p = v->arrayhash.find(vk);
-        if (p != v->arrayhash.end()) {
-          v = p->second;
-        }
-      }
-      break;
-
-    case VT_STRING:
-      {
-        VarKey vk(a->str);
-        auto p = v->arrayhash.find(vk);
-        if (p != v->arrayhash.end()) {
-          v = p->second;
-        }
-      }
-      break;
-
-    default:
-      return v;
     }
   }
   return v;
 }
 
 // 3項演算子
-shared_ptr<Var> PackageMinosys::eval_op_3term(Content *c) {
-  shared_ptr<Var> v0 = evaluate(c->pc.at(0));
+VarPtr PackageMinosys::eval_op_3term(Content *c) {
+  VarPtr v0 = evaluate(c->pc.at(0));
   if (v0->isTrue()) {
     return evaluate(c->pc.at(1));
   } else {
@@ -226,15 +239,22 @@ shared_ptr<Var> PackageMinosys::eval_op_3term(Content *c) {
 }
 
 // 単項 ! 演算子
-shared_ptr<Var> PackageMinosys::eval_op_monoNot(Content *c) {
-  shared_ptr<Var> v(evaluate(c->pc.at(0)));
-  shared_ptr<Var> r = make_shared<Var>((int)(v->isTrue() ? 0 : 1));
+VarPtr PackageMinosys::eval_op_monoNot(Content *c) {
+  return calc_monoNot(evaluate(c->pc.at(0)));
+}
+
+VarPtr PackageMinosys::calc_monoNot(const VarPtr &v) {
+  VarPtr r = newVar((int)(v->isTrue() ? 0 : 1));
   return r;
 }
 
 // 単項 ~ 演算子
-shared_ptr<Var> PackageMinosys::eval_op_negate(Content *c) {
-  shared_ptr<Var> v(evaluate(c->pc.at(0))->clone());
+VarPtr PackageMinosys::eval_op_negate(Content *c) {
+  return calc_negate(evaluate(c->pc.at(0)));
+}
+
+VarPtr PackageMinosys::calc_negate(const VarPtr &v0) {
+  VarPtr v(v0->clone());
   if (v->vtype == VT_INT) {
     v->inum = ~v->inum;
   }
@@ -242,9 +262,13 @@ shared_ptr<Var> PackageMinosys::eval_op_negate(Content *c) {
 }
 
 // 単項 - 演算子
-shared_ptr<Var> PackageMinosys::eval_op_monoMinus(Content *c) {
+VarPtr PackageMinosys::eval_op_monoMinus(Content *c) {
   // 値を評価する
-  shared_ptr<Var> v(evaluate(c->pc.at(0))->clone());
+  return calc_monoMinus(evaluate(c->pc.at(0)));
+}
+
+VarPtr PackageMinosys::calc_monoMinus(const VarPtr &v0) {
+  VarPtr v(v0->clone());
 
   switch (v->vtype) {
   case VT_INT:
@@ -260,90 +284,108 @@ shared_ptr<Var> PackageMinosys::eval_op_monoMinus(Content *c) {
 }
 
 // 配列を考慮して変数を作成する
-shared_ptr<Var> &PackageMinosys::createVar(const string &vname, vector<Content *> &pc) {
-  shared_ptr<Var> *pv = &eng->searchVar(vname, true);
-
-  if (!pc.empty()) {
-    for (int i = 0; i < pc.size(); i++) {
-      if ((*pv)->vtype != VT_ARRAY) {
-        // 配列でなければ配列化する
-        (*pv)->vtype = VT_ARRAY;
-      }
-      shared_ptr<Var> idx = evaluate(pc.at(i));
-      switch (idx->vtype) {
-      case VT_INT:
-        {
-          VarKey key(idx->inum);
-          pv = createVarIndex(key, pv);
-        }
-        break;
-
-      case VT_DNUM:
-        {
-          VarKey key(idx->dnum);
-          pv = createVarIndex(key, pv);
-        }
-        break;
-
-      case VT_STRING:
-        {
-          VarKey key(idx->str);
-          pv = createVarIndex(key, pv);
-        }
-        break;
-
-      default:
-        throw RuntimeException(1003, "hash index is not int/dnum/string");
+VarPtr &PackageMinosys::createVar(Content *lhs) {
+  if (lhs->pc.empty()) {
+    return eng->searchVar(lhs, true);
+  }
+  vector<VarPtr> idx;
+  for (int i = 0; i < lhs->pc.size(); i++) {
+    idx.push_back(evaluate(lhs->pc.at(i)));
+  }
+  return createVar(lhs, idx.data(), (int)idx.size());
+}
+
+// 評価済みの添字で変数を作成する
+VarPtr &PackageMinosys::createVar(Content *lhs, const VarPtr *idx, int nidx) {
+  VarPtr *pv = &eng->searchVar(lhs, true);
+
+  for (int i = 0; i < nidx; i++) {
+    if ((*pv)->vtype != VT_ARRAY) {
+      // 配列でなければ配列化する
+      (*pv)->settype(VT_ARRAY);
+    }
+    const VarPtr &ix = idx[i];
+    switch (ix->vtype) {
+    case VT_INT:
+      pv = &(*pv)->mutableArray().at(ix->inum);
+      break;
+
+    case VT_DNUM:
+      {
+        VarKey key(ix->dnum);
+        pv = createVarIndex(key, pv);
       }
+      break;
+
+    case VT_STRING:
+      pv = &(*pv)->mutableArray().at(ix->str());
+      break;
+
+    default:
+      throw RuntimeException(1003, "hash index is not int/dnum/string");
     }
   }
   return *pv;
 }
 
-// 配列要素を検索する。なければ作成する
-shared_ptr<Var> *PackageMinosys::createVarIndex(const VarKey &key, shared_ptr<Var> *pv) {
-  auto p = (*pv)->arrayhash.find(key);
-  if (p != (*pv)->arrayhash.end()) {
-    // 配列要素が見つかったので v を置き換える
-    return &(p->second);
-  } else {
-    // 配列要素が見つからなかったので、作成する
-    (*pv)->arrayhash[key] = make_shared<Var>();
-    return &((*pv)->arrayhash[key]);
+// 左辺の変数を作成してから右辺 rhs を評価して v2 に置き、左辺の変数を返す
+// 右辺の評価で配列に要素が追加されると先に得た要素への参照は無効になるので、
+// 添字がある場合は評価後に引き直す
+VarPtr &PackageMinosys::createVar(Content *lhs, Content *rhs, VarPtr &v2) {
+  if (lhs->pc.empty()) {
+    VarPtr &v = eng->searchVar(lhs, true);
+    v2 = evaluate(rhs);
+    return v;
   }
+  vector<VarPtr> idx;
+  for (int i = 0; i < lhs->pc.size(); i++) {
+    idx.push_back(evaluate(lhs->pc.at(i)));
+  }
+  createVar(lhs, idx.data(), (int)idx.size());
+  v2 = evaluate(rhs);
+  return createVar(lhs, idx.data(), (int)idx.size());
+}
+
+// 配列要素を検索する。なければ作成する
+VarPtr *PackageMinosys::createVarIndex(const VarKey &key, VarPtr *pv) {
+  return &(*pv)->mutableArray().at(key);
 }
 
 // 代入演算子の評価
-shared_ptr<Var> PackageMinosys::eval_op_assign(Content *c) {
+VarPtr PackageMinosys::eval_op_assign(Content *c) {
   // 左辺
   Content *lhs = c->pc.at(0);
 
   // 変数を探す; なければ作成する
-  shared_ptr<Var> &v = createVar(lhs->op, lhs->pc);
+  // 右辺は左辺を作成した後に評価される
+  VarPtr v2;
+  VarPtr &v = createVar(lhs, c->pc.at(1), v2);
 
   // TODO: メンバー変数の検索
 
-  // 右辺
-  v = evaluate(c->pc.at(1));
+  v = bindVar(v2);
   return v;
 }
 
 // 代入演算子: += の評価
-shared_ptr<Var> PackageMinosys::eval_op_assignplus(Content *c) {
+VarPtr PackageMinosys::eval_op_assignplus(Content *c) {
   // 左辺
   Content *lhs = c->pc.at(0);
 
   // 変数を探す; なければ作成する
-  shared_ptr<Var> &v1 = createVar(lhs->op, lhs->pc);
+  // 右辺は左辺を作成した後に評価される
+  VarPtr v2;
+  VarPtr &v1 = createVar(lhs, c->pc.at(1), v2);
 
   // TODO: メンバー変数の検索
 
-  // 右辺
-  shared_ptr<Var> v2 = evaluate(c->pc.at(1));
+  return calc_assignplus(v1, v2);
+}
 
+VarPtr PackageMinosys::calc_assignplus(VarPtr &v1, const VarPtr &v2) {
   switch (v1->vtype) {
   case VT_NULL:
-    v1 = v2;
+    v1 = bindVar(v2);
     return v1;
 
   case VT_INT:
@@ -356,13 +398,12 @@ shared_ptr<Var> PackageMinosys::eval_op_assignplus(Content *c) {
       return v1;
 
     case VT_DNUM:
-      v1->vtype = VT_DNUM;
+      v1->settype(VT_DNUM);
       v1->dnum = v1->inum + v2->dnum;
       return v1;
 
     case VT_STRING:
-      v1->vtype = VT_STRING;
-      v1->str = to_string(v1->inum) + v2->str;
+      v1->setString(to_string(v1->inum) + v2->str());
       return v1;
     }
     break;
@@ -381,8 +422,7 @@ shared_ptr<Var> PackageMinosys::eval_op_assignplus(Content *c) {
       return v1;
 
     case VT_STRING:
-      v1->vtype = VT_STRING;
-      v1->str = to_string(v1->dnum) + v2->str;
+      v1->setString(to_string(v1->dnum) + v2->str());
       return v1;
     }
     break;
@@ -393,15 +433,15 @@ shared_ptr<Var> PackageMinosys::eval_op_assignplus(Content *c) {
       return v1;
 
     case VT_INT:
-      v1->str += to_string(v2->inum);
+      v1->appendStr(to_string(v2->inum));
       return v1;
 
     case VT_DNUM:
-      v1->str += to_string(v2->dnum);
+      v1->appendStr(to_string(v2->dnum));
       return v1;
 
     case VT_STRING:
-      v1->str += v2->str;
+      v1->appendStr(v2->str());
       return v1;
     }
   }
@@ -411,28 +451,31 @@ shared_ptr<Var> PackageMinosys::eval_op_assignplus(Content *c) {
 }
 
 // 代入演算子: -=
-shared_ptr<Var> PackageMinosys::eval_op_assignminus(Content *c) {
+VarPtr PackageMinosys::eval_op_assignminus(Content *c) {
   // 左辺
   Content *lhs = c->pc.at(0);
 
   // 変数を探す; なければ作成する
-  shared_ptr<Var> &v1 = createVar(lhs->op, lhs->pc);
+  // 右辺は左辺を作成した後に評価される
+  VarPtr v2;
+  VarPtr &v1 = createVar(lhs, c->pc.at(1), v2);
 
   // TODO: メンバー変数の検索
 
-  // 右辺
-  shared_ptr<Var> v2 = evaluate(c->pc.at(1));
+  return calc_assignminus(v1, v2);
+}
 
+VarPtr PackageMinosys::calc_assignminus(VarPtr &v1, const VarPtr &v2) {
   switch (v1->vtype) {
   case VT_NULL:
     switch (v2->vtype) {
     case VT_INT:
-      v1->vtype = VT_INT;
+      v1->settype(VT_INT);
       v1->inum = -v2->inum;
       return v1;
 
     case VT_DNUM:
-      v1->vtype = VT_DNUM;
+      v1->settype(VT_DNUM);
       v1->inum = (int)-v2->dnum;
       return v1;
     }
@@ -445,7 +488,7 @@ shared_ptr<Var> PackageMinosys::eval_op_assignminus(Content *c) {
       return v1;
 
     case VT_DNUM:
-      v1->vtype = VT_DNUM;
+      v1->settype(VT_DNUM);
       v1->dnum = v1->inum - v2->dnum;
       return v1;
     }
@@ -469,18 +512,21 @@ shared_ptr<Var> PackageMinosys::eval_op_assignminus(Content *c) {
 }
 
 // 代入演算子: *=
-shared_ptr<Var> PackageMinosys::eval_op_assignmultiply(Content *c) {
+VarPtr PackageMinosys::eval_op_assignmultiply(Content *c) {
   // 左辺
   Content *lhs = c->pc.at(0);
 
   // 変数を探す; なければ作成する
-  shared_ptr<Var> &v1 = createVar(lhs->op, lhs->pc);
+  // 右辺は左辺を作成した後に評価される
+  VarPtr v2;
+  VarPtr &v1 = createVar(lhs, c->pc.at(1), v2);
 
   // TODO: メンバー変数の検索
 
-  // 右辺
-  shared_ptr<Var> v2 = evaluate(c->pc.at(1));
+  return calc_assignmultiply(v1, v2);
+}
 
+VarPtr PackageMinosys::calc_assignmultiply(VarPtr &v1, const VarPtr &v2) {
   switch (v1->vtype) {
   case VT_INT:
     switch (v2->vtype) {
@@ -489,13 +535,12 @@ shared_ptr<Var> PackageMinosys::eval_op_assignmultiply(Content *c) {
       return v1;
 
     case VT_DNUM:
-      v1->vtype = VT_DNUM;
+      v1->settype(VT_DNUM);
       v1->dnum = v1->inum * v2->dnum;
       return v1;
 
     case VT_STRING:
-      v1->vtype = VT_STRING;
-      v1->str = createMulString(v1->inum, v2->str);
+      v1->setString(createMulString(v1->inum, v2->str()));
       return v1;
     }
     break;
@@ -503,7 +548,7 @@ shared_ptr<Var> PackageMinosys::eval_op_assignmultiply(Content *c) {
   case VT_DNUM:
     switch (v2->vtype) {
     case VT_INT:
-      v1->vtype = VT_DNUM;
+      v1->settype(VT_DNUM);
       v1->dnum = v1->inum * v2->dnum;
       return v1;
 
@@ -512,8 +557,7 @@ shared_ptr<Var> PackageMinosys::eval_op_assignmultiply(Content *c) {
       return v1;
 
     case VT_STRING:
-      v1->vtype = VT_STRING;
-      v1->str = createMulString((int)v1->dnum, v2->str);
+      v1->setString(createMulString((int)v1->dnum, v2->str()));
       return v1;
     }
     break;
@@ -521,11 +565,11 @@ shared_ptr<Var> PackageMinosys::eval_op_assignmultiply(Content *c) {
   case VT_STRING:
     switch (v2->vtype) {
     case VT_INT:
-      v1->str = createMulString(v2->inum, v1->str);
+      v1->mutableStr() = createMulString(v2->inum, v1->str());
       return v1;
 
     case VT_DNUM:
-      v1->str = createMulString((int)v2->dnum, v1->str);
+      v1->mutableStr() = createMulString((int)v2->dnum, v1->str());
       return v1;
     }
     break;
@@ -536,18 +580,21 @@ shared_ptr<Var> PackageMinosys::eval_op_assignmultiply(Content *c) {
 }
 
 // 代入演算子: /=
-shared_ptr<Var> PackageMinosys::eval_op_assigndiv(Content *c) {
+VarPtr PackageMinosys::eval_op_assigndiv(Content *c) {
   // 左辺
   Content *lhs = c->pc.at(0);
 
   // 変数を探す; なければ作成する
-  shared_ptr<Var> &v1 = createVar(lhs->op, lhs->pc);
+  // 右辺は左辺を作成した後に評価される
+  VarPtr v2;
+  VarPtr &v1 = createVar(lhs, c->pc.at(1), v2);
 
   // TODO: メンバー変数の検索
-
-  // 右辺
-  shared_ptr<Var> v2 = evaluate(c->pc.at(1));
   
+  return calc_assigndiv(v1, v2);
+}
+
+VarPtr PackageMinosys::calc_assigndiv(VarPtr &v1, const VarPtr &v2) {
   switch (v1->vtype) {
   case VT_INT:
     switch (v2->vtype) {
@@ -556,7 +603,7 @@ shared_ptr<Var> PackageMinosys::eval_op_assigndiv(Content *c) {
       return v1;
 
     case VT_DNUM:
-      v1->vtype = VT_DNUM;
+      v1->settype(VT_DNUM);
       v1->dnum = v1->inum / v2->dnum;
       return v1;
     }
@@ -580,18 +627,21 @@ shared_ptr<Var> PackageMinosys::eval_op_assigndiv(Content *c) {
 }
 
 // 代入演算子: %=
-shared_ptr<Var> PackageMinosys::eval_op_assignmod(Content *c) {
+VarPtr PackageMinosys::eval_op_assignmod(Content *c) {
   // 左辺
   Content *lhs = c->pc.at(0);
 
   // 変数を探す; なければ作成する
-  shared_ptr<Var> &v1 = createVar(lhs->op, lhs->pc);
+  // 右辺は左辺を作成した後に評価される
+  VarPtr v2;
+  VarPtr &v1 = createVar(lhs, c->pc.at(1), v2);
 
   // TODO: メンバー変数の検索
 
-  // 右辺
-  shared_ptr<Var> v2 = evaluate(c->pc.at(1));
+  return calc_assignmod(v1, v2);
+}
 
+VarPtr PackageMinosys::calc_assignmod(VarPtr &v1, const VarPtr &v2) {
   switch (v1->vtype) {
   case VT_INT:
     switch (v2->vtype) {
@@ -608,12 +658,12 @@ shared_ptr<Var> PackageMinosys::eval_op_assignmod(Content *c) {
   case VT_DNUM:
     switch (v2->vtype) {
     case VT_INT:
-      v1->vtype = VT_INT;
+      v1->settype(VT_INT);
       v1->inum = ((int)v1->dnum) % v2->inum;
       return v1;
 
     case VT_DNUM:
-      v1->vtype = VT_INT;
+      v1->settype(VT_INT);
       v1->inum = ((int)v1->dnum) % (int)v2->dnum;
       return v1;
     }
@@ -625,18 +675,21 @@ shared_ptr<Var> PackageMinosys::eval_op_assignmod(Content *c) {
 }
 
 // 代入演算子: &=
-shared_ptr<Var> PackageMinosys::eval_op_assignand(Content *c) {
+VarPtr PackageMinosys::eval_op_assignand(Content *c) {
   // 左辺
   Content *lhs = c->pc.at(0);
 
   // 変数を探す; なければ作成する
-  shared_ptr<Var> &v1 = createVar(lhs->op, lhs->pc);
+  // 右辺は左辺を作成した後に評価される
+  VarPtr v2;
+  VarPtr &v1 = createVar(lhs, c->pc.at(1), v2);
 
   // TODO: メンバー変数の検索
- 
-  // 右辺
-  shared_ptr<Var> v2 = evaluate(c->pc.at(1));
 
+  return calc_assignand(v1, v2);
+}
+
+VarPtr PackageMinosys::calc_assignand(VarPtr &v1, const VarPtr &v2) {
   switch (v1->vtype) {
   case VT_INT:
     switch (v2->vtype) {
@@ -652,12 +705,12 @@ shared_ptr<Var> PackageMinosys::eval_op_assignand(Content *c) {
   case VT_DNUM:
     switch (v2->vtype) {
     case VT_INT:
-      v1->vtype = VT_INT;
+      v1->settype(VT_INT);
       v1->inum = (int)v1->dnum & v2->inum;
       return v1;
 
     case VT_DNUM:
-      v1->vtype = VT_INT;
+      v1->settype(VT_INT);
       v1->inum = (int)v1->dnum & (int)v2->dnum;
       return v1;
     }
@@ -669,18 +722,21 @@ shared_ptr<Var> PackageMinosys::eval_op_assignand(Content *c) {
 }
 
 // 代入演算子: |=
-shared_ptr<Var> PackageMinosys::eval_op_assignor(Content *c) {
+VarPtr PackageMinosys::eval_op_assignor(Content *c) {
   // 左辺
   Content *lhs = c->pc.at(0);
 
   // 変数を探す; なければ作成する
-  shared_ptr<Var> &v1 = createVar(lhs->op, lhs->pc);
+  // 右辺は左辺を作成した後に評価される
+  VarPtr v2;
+  VarPtr &v1 = createVar(lhs, c->pc.at(1), v2);
 
   // TODO: メンバー変数の検索
 
-  // 右辺
-  shared_ptr<Var> v2 = evaluate(c->pc.at(1));
+  return calc_assignor(v1, v2);
+}
 
+VarPtr PackageMinosys::calc_assignor(VarPtr &v1, const VarPtr &v2) {
   switch (v1->vtype) {
   case VT_INT:
     switch (v2->vtype) {
@@ -697,12 +753,12 @@ shared_ptr<Var> PackageMinosys::eval_op_assignor(Content *c) {
   case VT_DNUM:
     switch (v2->vtype) {
     case VT_INT:
-      v1->vtype = VT_INT;
+      v1->settype(VT_INT);
       v1->inum = (int)v1->dnum | v2->inum;
       return v1;
 
     case VT_DNUM:
-      v1->vtype = VT_INT;
+      v1->settype(VT_INT);
       v1->inum = (int)v1->dnum | (int)v2->dnum;
       return v1;
     }
@@ -714,18 +770,21 @@ shared_ptr<Var> PackageMinosys::eval_op_assignor(Content *c) {
 }
 
 // 代入演算子: ^=
-shared_ptr<Var> PackageMinosys::eval_op_assignxor(Content *c) {
+VarPtr PackageMinosys::eval_op_assignxor(Content *c) {
   // 左辺
   Content *lhs = c->pc.at(0);
 
   // 変数を探す; なければ作成する
-  shared_ptr<Var> &v1 = createVar(lhs->op, lhs->pc);
+  // 右辺は左辺を作成した後に評価される
+  VarPtr v2;
+  VarPtr &v1 = createVar(lhs, c->pc.at(1), v2);
 
   // TODO: メンバー変数の検索
 
-  // 右辺
-  shared_ptr<Var> v2 = evaluate(c->pc.at(1));
+  return calc_assignxor(v1, v2);
+}
 
+VarPtr PackageMinosys::calc_assignxor(VarPtr &v1, const VarPtr &v2) {
   switch (v1->vtype) {
   case VT_INT:
     switch (v2->vtype) {
@@ -742,12 +801,12 @@ shared_ptr<Var> PackageMinosys::eval_op_assignxor(Content *c) {
   case VT_DNUM:
     switch (v2->vtype) {
     case VT_INT:
-      v1->vtype = VT_INT;
+      v1->settype(VT_INT);
       v1->inum = (int)v1->dnum ^ v2->inum;
       return v1;
 
     case VT_DNUM:
-      v1->vtype = VT_INT;
+      v1->settype(VT_INT);
       v1->inum = (int)v1->dnum ^ (int)v2->dnum;
       return v1;
     }
@@ -759,18 +818,21 @@ shared_ptr<Var> PackageMinosys::eval_op_assignxor(Content *c) {
 }
 
 // 代入演算子: <<=
-shared_ptr<Var> PackageMinosys::eval_op_assignlsh(Content *c) {
+VarPtr PackageMinosys::eval_op_assignlsh(Content *c) {
   // 左辺
   Content *lhs = c->pc.at(0);
 
   // 変数を探す; なければ作成する
-  shared_ptr<Var> &v1 = createVar(lhs->op, lhs->pc);
+  // 右辺は左辺を作成した後に評価される
+  VarPtr v2;
+  VarPtr &v1 = createVar(lhs, c->pc.at(1), v2);
 
   // TODO: メンバー変数の検索
 
-  // 右辺
-  shared_ptr<Var> v2 = evaluate(c->pc.at(1));
+  return calc_assignlsh(v1, v2);
+}
 
+VarPtr PackageMinosys::calc_assignlsh(VarPtr &v1, const VarPtr &v2) {
   switch (v1->vtype) {
   case VT_INT:
     switch (v2->vtype) {
@@ -787,12 +849,12 @@ shared_ptr<Var> PackageMinosys::eval_op_assignlsh(Content *c) {
   case VT_DNUM:
     switch (v2->vtype) {
     case VT_INT:
-      v1->vtype = VT_INT;
+      v1->settype(VT_INT);
       v1->inum = (int)v1->dnum << v2->inum;
       return v1;
 
     case VT_DNUM:
-      v1->vtype = VT_INT;
+      v1->settype(VT_INT);
       v1->inum = (int)v1->dnum << (int)v2->dnum;
       return v1;
     }
@@ -801,11 +863,11 @@ shared_ptr<Var> PackageMinosys::eval_op_assignlsh(Content *c) {
   case VT_STRING:
     switch (v2->vtype) {
     case VT_INT:
-      v1->str += createMulString(v2->inum, " ");
+      v1->mutableStr() += createMulString(v2->inum, " ");
       return v1;
 
     case VT_DNUM:
-      v1->str += createMulString((int)v2->dnum, " ");
+      v1->mutableStr() += createMulString((int)v2->dnum, " ");
       return v1;
     }
     break;
@@ -816,18 +878,21 @@ shared_ptr<Var> PackageMinosys::eval_op_assignlsh(Content *c) {
 }
 
 // 代入演算子: >>=
-shared_ptr<Var> PackageMinosys::eval_op_assignrsh(Content *c) {
+VarPtr PackageMinosys::eval_op_assignrsh(Content *c) {
   // 左辺
   Content *lhs = c->pc.at(0);
 
   // 変数を探す; なければ作成する
-  shared_ptr<Var> &v1 = createVar(lhs->op, lhs->pc);
+  // 右辺は左辺を作成した後に評価される
+  VarPtr v2;
+  VarPtr &v1 = createVar(lhs, c->pc.at(1), v2);
 
   // TODO: メンバー変数の検索
 
-  // 右辺
-  shared_ptr<Var> v2 = evaluate(c->pc.at(1));
+  return calc_assignrsh(v1, v2);
+}
 
+VarPtr PackageMinosys::calc_assignrsh(VarPtr &v1, const VarPtr &v2) {
   switch (v1->vtype) {
   case VT_INT:
     switch (v2->vtype) {
@@ -844,12 +909,12 @@ shared_ptr<Var> PackageMinosys::eval_op_assignrsh(Content *c) {
   case VT_DNUM:
     switch (v2->vtype) {
     case VT_INT:
-      v1->vtype = VT_INT;
+      v1->settype(VT_INT);
       v1->inum = (int)v1->dnum >> v2->inum;
       return v1;
 
     case VT_DNUM:
-      v1->vtype = VT_INT;
+      v1->settype(VT_INT);
       v1->inum = (int)v1->dnum >> (int)v2->dnum;
       return v1;
     }
@@ -858,11 +923,11 @@ shared_ptr<Var> PackageMinosys::eval_op_assignrsh(Content *c) {
   case VT_STRING:
     switch (v2->vtype) {
     case VT_INT:
-      v1->str = createMulString(v2->inum, " ") + v1->str;
+      v1->mutableStr() = createMulString(v2->inum, " ") + v1->str();
       return v1;
 
     case VT_DNUM:
-      v1->str = createMulString((int)v2->dnum, " ") + v1->str;
+      v1->mutableStr() = createMulString((int)v2->dnum, " ") + v1->str();
       return v1;
     }
     break;
@@ -873,14 +938,17 @@ shared_ptr<Var> PackageMinosys::eval_op_assignrsh(Content *c) {
 }
 
 // 前置 +1 演算子の評価
-shared_ptr<Var> PackageMinosys::eval_op_preIncr(Content *c) {
+VarPtr PackageMinosys::eval_op_preIncr(Content *c) {
   // 変数を探す; なければ作成する
   Content *lhs = c->pc.at(0);
-  shared_ptr<Var> &v = createVar(lhs->op, lhs->pc);
+  VarPtr &v = createVar(lhs);
+  return calc_preIncr(v);
+}
 
+VarPtr PackageMinosys::calc_preIncr(VarPtr &v) {
   switch (v->vtype) {
   case VT_NULL:
-    v->vtype = VT_INT;
+    v->settype(VT_INT);
     v->inum = 1;
     break;
 
@@ -897,20 +965,24 @@ shared_ptr<Var> PackageMinosys::eval_op_preIncr(Content *c) {
 }
 
 // 後置 +1 演算子の評価
-shared_ptr<Var> PackageMinosys::eval_op_postIncr(Content *c) {
+VarPtr PackageMinosys::eval_op_postIncr(Content *c) {
   // 変数を探す
   Content *lhs = c->pc.at(0);
-  shared_ptr<Var> &v = createVar(lhs->op, lhs->pc);
-  shared_ptr<Var> vclone(v->clone());
+  VarPtr &v = createVar(lhs);
+  return calc_postIncr(v);
+}
+
+VarPtr PackageMinosys::calc_postIncr(VarPtr &v) {
+  VarPtr vclone(v->clone());
 
   if (vclone->vtype == VT_NULL) {
-    vclone->vtype = VT_INT;
+    vclone->settype(VT_INT);
     vclone->inum = 0;
   }
 
   switch (v->vtype) {
   case VT_NULL:
-    v->vtype = VT_INT;
+    v->settype(VT_INT);
     v->inum = 1;
     break;
 
@@ -927,14 +999,17 @@ shared_ptr<Var> PackageMinosys::eval_op_postIncr(Content *c) {
 }
 
 // 前置 -1 演算子の評価
-shared_ptr<Var> PackageMinosys::eval_op_preDecr(Content *c) {
+VarPtr PackageMinosys::eval_op_preDecr(Content *c) {
   // 変数を探す
   Content *lhs = c->pc.at(0);
-  shared_ptr<Var> &v = createVar(lhs->op, lhs->pc);
+  VarPtr &v = createVar(lhs);
+  return calc_preDecr(v);
+}
 
+VarPtr PackageMinosys::calc_preDecr(VarPtr &v) {
   switch (v->vtype) {
   case VT_NULL:
-    v->vtype = VT_INT;
+    v->settype(VT_INT);
     v->inum = -1;
     break;
 
@@ -951,15 +1026,19 @@ shared_ptr<Var> PackageMinosys::eval_op_preDecr(Content *c) {
 }
 
 // 後置 -1 演算子の評価
-shared_ptr<Var> PackageMinosys::eval_op_postDecr(Content *c) {
+VarPtr PackageMinosys::eval_op_postDecr(Content *c) {
   // 変数を探す
   Content *lhs = c->pc.at(0);
-  shared_ptr<Var> &v = createVar(lhs->op, lhs->pc);
-  shared_ptr<Var> vclone(v->clone());
+  VarPtr &v = createVar(lhs);
+  return calc_postDecr(v);
+}
+
+VarPtr PackageMinosys::calc_postDecr(VarPtr &v) {
+  VarPtr vclone(v->clone());
 
   switch (v->vtype) {
   case VT_NULL:
-    v->vtype = VT_INT;
+    v->settype(VT_INT);
     v->inum = -1;
     break;
 
@@ -976,57 +1055,63 @@ shared_ptr<Var> PackageMinosys::eval_op_postDecr(Content *c) {
 }
 
 // 比較演算子: <
-shared_ptr<Var> PackageMinosys::eval_op_lt(Content *c) {
-  shared_ptr<Var> v1 = evaluate(c->pc.at(0));
-  shared_ptr<Var> v2 = evaluate(c->pc.at(1));
+VarPtr PackageMinosys::eval_op_lt(Content *c) {
+  VarPtr v1 = evaluate(c->pc.at(0));
+  VarPtr v2 = evaluate(c->pc.at(1));
+  return calc_lt(v1, v2);
+}
 
+VarPtr PackageMinosys::calc_lt(const VarPtr &v1, const VarPtr &v2) {
   switch (v1->vtype) {
   case VT_NULL:
     switch (v2->vtype) {
     case VT_INT:
     case VT_DNUM:
-      return make_shared<Var>(1);
+      return newVar(1);
 
     case VT_STRING:
-      return make_shared<Var>((int)(v2->str.empty() ? 0 : 1));
+      return newVar((int)(v2->str().empty() ? 0 : 1));
     }
     break;
 
   case VT_INT:
     switch (v2->vtype) {
     case VT_INT:
-      return make_shared<Var>((int)(v1->inum < v2->inum ? 1 : 0));
+      return newVar((int)(v1->inum < v2->inum ? 1 : 0));
 
     case VT_DNUM:
-      return make_shared<Var>((int)(v1->inum < v2->dnum ? 1: 0));
+      return newVar((int)(v1->inum < v2->dnum ? 1: 0));
     }
     break;
 
   case VT_DNUM:
     switch (v2->vtype) {
     case VT_INT:
-      return make_shared<Var>((int)(v1->dnum < v2->inum ? 1 : 0));
+      return newVar((int)(v1->dnum < v2->inum ? 1 : 0));
 
     case VT_DNUM:
-      return make_shared<Var>((int)(v1->dnum < v2->dnum ? 1: 0));
+      return newVar((int)(v1->dnum < v2->dnum ? 1: 0));
     }
     break;
 
   case VT_STRING:
     if (v2->vtype == VT_STRING) {
-      return make_shared<Var>((int)(v1->str < v2->str ? 1 : 0));
+      return newVar((int)(v1->str() < v2->str() ? 1 : 0));
     }
   }
 
   // 判定できない場合は[偽]を返す
-  return make_shared<Var>((int)0);
+  return newVar((int)0);
 }
 
 // 比較演算子: <=
-shared_ptr<Var> PackageMinosys::eval_op_lteq(Content *c) {
-  shared_ptr<Var> v1 = evaluate(c->pc.at(0));
-  shared_ptr<Var> v2 = evaluate(c->pc.at(1));
+VarPtr PackageMinosys::eval_op_lteq(Content *c) {
+  VarPtr v1 = evaluate(c->pc.at(0));
+  VarPtr v2 = evaluate(c->pc.at(1));
+  return calc_lteq(v1, v2);
+}
 
+VarPtr PackageMinosys::calc_lteq(const VarPtr &v1, const VarPtr &v2) {
   switch (v1->vtype) {
   case VT_NULL:
     switch (v2->vtype) {
@@ -1034,92 +1119,98 @@ shared_ptr<Var> PackageMinosys::eval_op_lteq(Content *c) {
     case VT_INT:
     case VT_DNUM:
     case VT_STRING:
-      return make_shared<Var>(1);
+      return newVar(1);
     }
     break;
 
   case VT_INT:
     switch (v2->vtype) {
     case VT_INT:
-      return make_shared<Var>((int)(v1->inum <= v2->inum ? 1 : 0));
+      return newVar((int)(v1->inum <= v2->inum ? 1 : 0));
 
     case VT_DNUM:
-      return make_shared<Var>((int)(v1->inum <= v2->dnum ? 1: 0));
+      return newVar((int)(v1->inum <= v2->dnum ? 1: 0));
     }
     break;
 
   case VT_DNUM:
     switch (v2->vtype) {
     case VT_INT:
-      return make_shared<Var>((int)(v1->dnum <= v2->inum ? 1 : 0));
+      return newVar((int)(v1->dnum <= v2->inum ? 1 : 0));
 
     case VT_DNUM:
-      return make_shared<Var>((int)(v1->dnum <= v2->dnum ? 1: 0));
+      return newVar((int)(v1->dnum <= v2->dnum ? 1: 0));
     }
     break;
 
   case VT_STRING:
     if (v2->vtype == VT_STRING) {
-      return make_shared<Var>((int)(v1->str <= v2->str ? 1 : 0));
+      return newVar((int)(v1->str() <= v2->str() ? 1 : 0));
     }
   }
 
   // 判定できない場合は[偽]を返す
-  return make_shared<Var>((int)0);
+  return newVar((int)0);
 }
 
 // 比較演算子: >
-shared_ptr<Var> PackageMinosys::eval_op_gt(Content *c) {
-  shared_ptr<Var> v1 = evaluate(c->pc.at(0));
-  shared_ptr<Var> v2 = evaluate(c->pc.at(1));
+VarPtr PackageMinosys::eval_op_gt(Content *c) {
+  VarPtr v1 = evaluate(c->pc.at(0));
+  VarPtr v2 = evaluate(c->pc.at(1));
+  return calc_gt(v1, v2);
+}
 
+VarPtr PackageMinosys::calc_gt(const VarPtr &v1, const VarPtr &v2) {
   switch (v2->vtype) {
   case VT_NULL:
     switch (v1->vtype) {
     case VT_INT:
     case VT_DNUM:
-      return make_shared<Var>(1);
+      return newVar(1);
 
     case VT_STRING:
-      return make_shared<Var>((int)(v1->str.empty() ? 0 : 1));
+      return newVar((int)(v1->str().empty() ? 0 : 1));
     }
     break;
 
   case VT_INT:
     switch (v1->vtype) {
     case VT_INT:
-      return make_shared<Var>((int)(v1->inum > v2->inum ? 1 : 0));
+      return newVar((int)(v1->inum > v2->inum ? 1 : 0));
 
     case VT_DNUM:
-      return make_shared<Var>((int)(v1->dnum > v2->inum ? 1: 0));
+      return newVar((int)(v1->dnum > v2->inum ? 1: 0));
     }
     break;
 
   case VT_DNUM:
     switch (v1->vtype) {
     case VT_INT:
-      return make_shared<Var>((int)(v1->inum > v2->dnum ? 1 : 0));
+      return newVar((int)(v1->inum > v2->dnum ? 1 : 0));
 
     case VT_DNUM:
-      return make_shared<Var>((int)(v1->dnum > v2->dnum ? 1: 0));
+      return newVar((int)(v1->dnum > v2->dnum ? 1: 0));
     }
     break;
 
   case VT_STRING:
-    if (v2->vtype == VT_STRING) {
-      return make_shared<Var>((int)(v1->str > v2->str ? 1 : 0));
+    if (v1->vtype == VT_STRING) {
+      return newVar((int)(v1->str() > v2->str() ? 1 : 0));
     }
   }
 
   // 判定できない場合は[偽]を返す
-  return make_shared<Var>((int)0);
+  return newVar((int)0);
 }
 
 // 比較演算子: >=
-shared_ptr<Var> PackageMinosys::eval_op_gteq(Content *c) {
-  shared_ptr<Var> v1 = evaluate(c->pc.at(0));
-  shared_ptr<Var> v2 = evaluate(c->pc.at(1));
+VarPtr PackageMinosys::eval_op_gteq(Content *c) {
+  VarPtr v1 = evaluate(c->pc.at(0));
+  VarPtr v2 = evaluate(c->pc.at(1));
+  return calc_gteq(v1, v2);
+}
 
+VarPtr PackageMinosys::calc_gteq(const VarPtr &v1, const VarPtr &v2) {
   switch (v2->vtype) {
   case VT_NULL:
     switch (v1->vtype) {
@@ -1127,440 +1218,476 @@ shared_ptr<Var> PackageMinosys::eval_op_gteq(Content *c) {
     case VT_INT:
     case VT_DNUM:
     case VT_STRING:
-      return make_shared<Var>(1);
+      return newVar(1);
     }
     break;
 
   case VT_INT:
     switch (v1->vtype) {
     case VT_INT:
-      return make_shared<Var>((int)(v1->inum >= v2->inum ? 1 : 0));
+      return newVar((int)(v1->inum >= v2->inum ? 1 : 0));
 
     case VT_DNUM:
-      return make_shared<Var>((int)(v1->dnum >= v2->inum ? 1: 0));
+      return newVar((int)(v1->dnum >= v2->inum ? 1: 0));
     }
     break;
 
   case VT_DNUM:
     switch (v1->vtype) {
     case VT_INT:
-      return make_shared<Var>((int)(v1->inum >= v2->dnum ? 1 : 0));
+      return newVar((int)(v1->inum >= v2->dnum ? 1 : 0));
 
     case VT_DNUM:
-      return make_shared<Var>((int)(v1->dnum >= v2->dnum ? 1: 0));
+      return newVar((int)(v1->dnum >= v2->dnum ? 1: 0));
     }
     break;
 
   case VT_STRING:
-    if (v2->vtype == VT_STRING) {
-      return make_shared<Var>((int)(v1->str >= v2->str ? 1 : 0));
+    if (v1->vtype == VT_STRING) {
+      return newVar((int)(v1->str() >= v2->str() ? 1 : 0));
     }
   }
 
   // 判定できない場合は[偽]を返す
-  return make_shared<Var>((int)0);
+  return newVar((int)0);
 }
 
 // 比較演算子: !=
-shared_ptr<Var> PackageMinosys::eval_op_neq(Content *c) {
-  shared_ptr<Var> v1 = evaluate(c->pc.at(0));
-  shared_ptr<Var> v2 = evaluate(c->pc.at(1));
+VarPtr PackageMinosys::eval_op_neq(Content *c) {
+  VarPtr v1 = evaluate(c->pc.at(0));
+  VarPtr v2 = evaluate(c->pc.at(1));
+  return calc_neq(v1, v2);
+}
 
-  return make_shared<Var> ((int)(*v1 == *v2 ? 0 : 1));
+VarPtr PackageMinosys::calc_neq(const VarPtr &v1, const VarPtr &v2) {
+  return newVar((int)(*v1 == *v2 ? 0 : 1));
 }
 
 // 比較演算子: ==
-shared_ptr<Var> PackageMinosys::eval_op_eq(Content *c) {
-  shared_ptr<Var> v1 = evaluate(c->pc.at(0));
-  shared_ptr<Var> v2 = evaluate(c->pc.at(1));
+VarPtr PackageMinosys::eval_op_eq(Content *c) {
+  VarPtr v1 = evaluate(c->pc.at(0));
+  VarPtr v2 = evaluate(c->pc.at(1));
+  return calc_eq(v1, v2);
+}
 
-  return make_shared<Var> ((int)(*v1 == *v2 ? 1 : 0));
+VarPtr PackageMinosys::calc_eq(const VarPtr &v1, const VarPtr &v2) {
+  return newVar((int)(*v1 == *v2 ? 1 : 0));
 }
 
 // 二項演算子: +
-shared_ptr<Var> PackageMinosys::eval_op_plus(Content *c) {
-  shared_ptr<Var> v1 = evaluate(c->pc.at(0));
-  shared_ptr<Var> v2 = evaluate(c->pc.at(1));
+VarPtr PackageMinosys::eval_op_plus(Content *c) {
+  VarPtr v1 = evaluate(c->pc.at(0));
+  VarPtr v2 = evaluate(c->pc.at(1));
+  return calc_plus(v1, v2);
+}
 
+VarPtr PackageMinosys::calc_plus(const VarPtr &v1, const VarPtr &v2) {
   switch(v1->vtype) {
   case VT_INT:
     switch (v2->vtype) {
     case VT_INT:
-      return make_shared<Var>(v1->inum + v2->inum);
+      return newVar(v1->inum + v2->inum);
 
     case VT_DNUM:
-      return make_shared<Var>(v1->inum + v2->dnum);
+      return newVar(v1->inum + v2->dnum);
 
     case VT_STRING:
-      return make_shared<Var>(to_string(v1->inum) + v2->str);
+      return newVar(to_string(v1->inum) + v2->str());
     }
     break;
 
   case VT_DNUM:
     switch (v2->vtype) {
     case VT_INT:
-      return make_shared<Var>(v1->dnum + v2->inum);
+      return newVar(v1->dnum + v2->inum);
 
     case VT_DNUM:
-      return make_shared<Var>(v1->dnum + v2->dnum);
+      return newVar(v1->dnum + v2->dnum);
 
     case VT_STRING:
-      return make_shared<Var>(to_string(v1->dnum) + v2->str);
+      return newVar(to_string(v1->dnum) + v2->str());
     }
     break;
 
   case VT_STRING:
     switch (v2->vtype) {
     case VT_INT:
-      return make_shared<Var>(v1->str + to_string(v2->inum));
+      return v1->concat(to_string(v2->inum));
 
     case VT_DNUM:
-      return make_shared<Var>(v1->str + to_string(v2->dnum));
+      return v1->concat(to_string(v2->dnum));
 
     case VT_STRING:
-      return make_shared<Var>(v1->str + v2->str);
+      return v1->concat(v2->str());
     }
     break;
   }
 
   // 無効な演算
-  return make_shared<Var>();
+  return newVar();
 }
 
 // 二項演算子: -
-shared_ptr<Var> PackageMinosys::eval_op_minus(Content *c) {
-  shared_ptr<Var> v1 = evaluate(c->pc.at(0));
-  shared_ptr<Var> v2 = evaluate(c->pc.at(1));
+VarPtr PackageMinosys::eval_op_minus(Content *c) {
+  VarPtr v1 = evaluate(c->pc.at(0));
+  VarPtr v2 = evaluate(c->pc.at(1));
+  return calc_minus(v1, v2);
+}
 
+VarPtr PackageMinosys::calc_minus(const VarPtr &v1, const VarPtr &v2) {
   switch (v1->vtype) {
   case VT_INT:
     switch (v2->vtype) {
     case VT_INT:
-      return make_shared<Var>(v1->inum - v2->inum);
+      return newVar(v1->inum - v2->inum);
 
     case VT_DNUM:
-      return make_shared<Var>(v1->inum - v2->dnum);
+      return newVar(v1->inum - v2->dnum);
     }
     break;
 
   case VT_DNUM:
     switch (v2->vtype) {
     case VT_INT:
-      return make_shared<Var>(v1->dnum - v2->inum);
+      return newVar(v1->dnum - v2->inum);
 
     case VT_DNUM:
-      return make_shared<Var>(v1->dnum - v2->dnum);
+      return newVar(v1->dnum - v2->dnum);
     }
     break;
   }
 
   // 評価できない場合は NULL を返す
-  return make_shared<Var>();
+  return newVar();
 }
 
 // 二項演算子: *
-shared_ptr<Var> PackageMinosys::eval_op_multiply(Content *c) {
-  shared_ptr<Var> v1 = evaluate(c->pc.at(0));
-  shared_ptr<Var> v2 = evaluate(c->pc.at(1));
+VarPtr PackageMinosys::eval_op_multiply(Content *c) {
+  VarPtr v1 = evaluate(c->pc.at(0));
+  VarPtr v2 = evaluate(c->pc.at(1));
+  return calc_multiply(v1, v2);
+}
 
+VarPtr PackageMinosys::calc_multiply(const VarPtr &v1, const VarPtr &v2) {
   switch (v1->vtype) {
   case VT_INT:
     switch (v2->vtype) {
     case VT_INT:
-      return make_shared<Var>(v1->inum * v2->inum);
+      return newVar(v1->inum * v2->inum);
 
     case VT_DNUM:
-      return make_shared<Var>(v1->inum * v2->dnum);
+      return newVar(v1->inum * v2->dnum);
 
     case VT_STRING:
-      return make_shared<Var>(createMulString(v1->inum, v2->str));
+      return newVar(createMulString(v1->inum, v2->str()));
     }
     break;
 
   case VT_DNUM:
     switch (v2->vtype) {
     case VT_INT:
-      return make_shared<Var>(v1->dnum * v2->inum);
+      return newVar(v1->dnum * v2->inum);
 
     case VT_DNUM:
-      return make_shared<Var>(v1->dnum * v2->dnum);
+      return newVar(v1->dnum * v2->dnum);
 
     case VT_STRING:
-      return make_shared<Var>(createMulString((int)v1->dnum, v2->str));
+      return newVar(createMulString((int)v1->dnum, v2->str()));
     }
     break;
 
   case VT_STRING:
     switch (v2->vtype) {
     case VT_INT:
-      return make_shared<Var>(createMulString(v2->inum, v1->str));
+      return newVar(createMulString(v2->inum, v1->str()));
 
     case VT_DNUM:
-      return make_shared<Var>(createMulString((int)v2->dnum, v1->str));
+      return newVar(createMulString((int)v2->dnum, v1->str()));
     }
     break;
   }
 
   // 無効な演算
-  return make_shared<Var>();
+  return newVar();
 }
 
 // 二項演算子: /
-shared_ptr<Var> PackageMinosys::eval_op_div(Content *c) {
-  shared_ptr<Var> v1 = evaluate(c->pc.at(0));
-  shared_ptr<Var> v2 = evaluate(c->pc.at(1));
+VarPtr PackageMinosys::eval_op_div(Content *c) {
+  VarPtr v1 = evaluate(c->pc.at(0));
+  VarPtr v2 = evaluate(c->pc.at(1));
+  return calc_div(v1, v2);
+}
 
+VarPtr PackageMinosys::calc_div(const VarPtr &v1, const VarPtr &v2) {
   switch (v1->vtype) {
   case VT_INT:
     switch (v2->vtype) {
     case VT_INT:
-      return make_shared<Var>(v1->inum / v2->inum);
+      return newVar(v1->inum / v2->inum);
 
     case VT_DNUM:
-      return make_shared<Var>(v1->inum / v2->dnum);
+      return newVar(v1->inum / v2->dnum);
     }
     break;
 
   case VT_DNUM:
     switch (v2->vtype) {
     case VT_INT:
-      return make_shared<Var>(v1->dnum / v2->inum);
+      return newVar(v1->dnum / v2->inum);
 
     case VT_DNUM:
-      return make_shared<Var>(v1->dnum / v2->dnum);
+      return newVar(v1->dnum / v2->dnum);
     }
     break;
   }
 
   // 無効な演算
-  return make_shared<Var>();
+  return newVar();
 }
 
 // 二項演算子: %
-shared_ptr<Var> PackageMinosys::eval_op_mod(Content *c) {
-  shared_ptr<Var> v1 = evaluate(c->pc.at(0));
-  shared_ptr<Var> v2 = evaluate(c->pc.at(1));
+VarPtr PackageMinosys::eval_op_mod(Content *c) {
+  VarPtr v1 = evaluate(c->pc.at(0));
+  VarPtr v2 = evaluate(c->pc.at(1));
+  return calc_mod(v1, v2);
+}
 
+VarPtr PackageMinosys::calc_mod(const VarPtr &v1, const VarPtr &v2) {
   switch (v1->vtype) {
   case VT_INT:
     switch (v2->vtype) {
     case VT_INT:
-      return make_shared<Var>(v1->inum % v2->inum);
+      return newVar(v1->inum % v2->inum);
 
     case VT_DNUM:
-      return make_shared<Var>(v1->inum % (int)v2->dnum);
+      return newVar(v1->inum % (int)v2->dnum);
     }
     break;
 
   case VT_DNUM:
     switch (v2->vtype) {
     case VT_INT:
-      return make_shared<Var>((int)v1->dnum % v2->inum);
+      return newVar((int)v1->dnum % v2->inum);
 
     case VT_DNUM:
-      return make_shared<Var>((int)v1->dnum % (int)v1->dnum);
+      return newVar((int)v1->dnum % (int)v1->dnum);
     }
     break;
   }
 
   // 無効な演算の場合は NULL を返す
-  return make_shared<Var>();
+  return newVar();
 }
 
 // 二項演算子: &
-shared_ptr<Var> PackageMinosys::eval_op_and(Content *c) {
-  shared_ptr<Var> v1 = evaluate(c->pc.at(0));
-  shared_ptr<Var> v2 = evaluate(c->pc.at(1));
+VarPtr PackageMinosys::eval_op_and(Content *c) {
+  VarPtr v1 = evaluate(c->pc.at(0));
+  VarPtr v2 = evaluate(c->pc.at(1));
+  return calc_and(v1, v2);
+}
 
+VarPtr PackageMinosys::calc_and(const VarPtr &v1, const VarPtr &v2) {
   switch (v1->vtype) {
   case VT_INT:
     switch (v2->vtype) {
     case VT_INT:
-      return make_shared<Var>(v1->inum & v2->inum);
+      return newVar(v1->inum & v2->inum);
 
     case VT_DNUM:
-      return make_shared<Var>(v1->inum & (int)v2->dnum);
+      return newVar(v1->inum & (int)v2->dnum);
     }
     break;
 
   case VT_DNUM:
     switch (v2->vtype) {
     case VT_INT:
-      return make_shared<Var>((int)v1->dnum & v2->inum);
+      return newVar((int)v1->dnum & v2->inum);
 
     case VT_DNUM:
-      return make_shared<Var>((int)v1->dnum & (int)v2->dnum);
+      return newVar((int)v1->dnum & (int)v2->dnum);
     }
     break;
   }
 
   // 無効な演算の場合は NULL を返す
-  return make_shared<Var>();
+  return newVar();
 }
 
 // 二項演算子: |
-shared_ptr<Var> PackageMinosys::eval_op_or(Content *c) {
-  shared_ptr<Var> v1 = evaluate(c->pc.at(0));
-  shared_ptr<Var> v2 = evaluate(c->pc.at(1));
+VarPtr PackageMinosys::eval_op_or(Content *c) {
+  VarPtr v1 = evaluate(c->pc.at(0));
+  VarPtr v2 = evaluate(c->pc.at(1));
+  return calc_or(v1, v2);
+}
 
+VarPtr PackageMinosys::calc_or(const VarPtr &v1, const VarPtr &v2) {
   switch (v1->vtype) {
   case VT_INT:
     switch (v2->vtype) {
     case VT_INT:
-      return make_shared<Var>(v1->inum | v2->inum);
+      return newVar(v1->inum | v2->inum);
 
     case VT_DNUM:
-      return make_shared<Var>(v1->inum | (int)v2->dnum);
+      return newVar(v1->inum | (int)v2->dnum);
     }
     break;
 
   case VT_DNUM:
     switch (v2->vtype) {
     case VT_INT:
-      return make_shared<Var>((int)v1->dnum | v2->inum);
+      return newVar((int)v1->dnum | v2->inum);
 
     case VT_DNUM:
-      return make_shared<Var>((int)v1->dnum | (int)v2->dnum);
+      return newVar((int)v1->dnum | (int)v2->dnum);
     }
   }
 
   // 無効な演算の場合は NULL を返す
-  return make_shared<Var>();
+  return newVar();
 }
 
 // 二項演算子: ^
-shared_ptr<Var> PackageMinosys::eval_op_xor(Content *c) {
-  shared_ptr<Var> v1 = evaluate(c->pc.at(0));
-  shared_ptr<Var> v2 = evaluate(c->pc.at(1));
+VarPtr PackageMinosys::eval_op_xor(Content *c) {
+  VarPtr v1 = evaluate(c->pc.at(0));
+  VarPtr v2 = evaluate(c->pc.at(1));
+  return calc_xor(v1, v2);
+}
 
+VarPtr PackageMinosys::calc_xor(const VarPtr &v1, const VarPtr &v2) {
   switch (v1->vtype) {
   case VT_INT:
     switch (v2->vtype) {
     case VT_INT:
-      return make_shared<Var>(v1->inum ^ v2->inum);
+      return newVar(v1->inum ^ v2->inum);
 
     case VT_DNUM:
-      return make_shared<Var>(v1->inum ^ (int)v2->dnum);
+      return newVar(v1->inum ^ (int)v2->dnum);
     }
     break;
 
   case VT_DNUM:
     switch(v2->vtype) {
     case VT_INT:
-      return make_shared<Var>(v1->inum ^ (int)v2->dnum);
+      return newVar(v1->inum ^ (int)v2->dnum);
 
     case VT_DNUM:
-      return make_shared<Var>((int)v1->dnum ^ (int)v2->dnum);
+      return newVar((int)v1->dnum ^ (int)v2->dnum);
     }
     break;
   }
 
   // 無効な演算の場合は NULL を返す
-  return make_shared<Var>();
+  return newVar();
 }
 
 // 二項演算子: &&
-shared_ptr<Var> PackageMinosys::eval_op_logand(Content *c) {
-  shared_ptr<Var> v1 = evaluate(c->pc.at(0));
+VarPtr PackageMinosys::eval_op_logand(Content *c) {
+  VarPtr v1 = evaluate(c->pc.at(0));
 
   if (!v1->isTrue()) {
-    return make_shared<Var>((int)0);
+    return newVar((int)0);
   }
-  shared_ptr<Var> v2 = evaluate(c->pc.at(1));
-  return make_shared<Var>(v2->isTrue() ? 1: (int)0);
+  VarPtr v2 = evaluate(c->pc.at(1));
+  return newVar(v2->isTrue() ? 1: (int)0);
 }
 
 // 二項演算子: ||
-shared_ptr<Var> PackageMinosys::eval_op_logor(Content *c) {
-  shared_ptr<Var> v1 = evaluate(c->pc.at(0));
+VarPtr PackageMinosys::eval_op_logor(Content *c) {
+  VarPtr v1 = evaluate(c->pc.at(0));
 
   if (v1->isTrue()) {
-    return make_shared<Var>(1);
+    return newVar(1);
   }
-  shared_ptr<Var> v2 = evaluate(c->pc.at(1));
-  return make_shared<Var>(v2->isTrue() ? 1 : (int)0);
+  VarPtr v2 = evaluate(c->pc.at(1));
+  return newVar(v2->isTrue() ? 1 : (int)0);
 }
 
 // 二項演算子: <<
-shared_ptr<Var> PackageMinosys::eval_op_lsh(Content *c) {
-  shared_ptr<Var> v1 = evaluate(c->pc.at(0));
-  shared_ptr<Var> v2 = evaluate(c->pc.at(1));
+VarPtr PackageMinosys::eval_op_lsh(Content *c) {
+  VarPtr v1 = evaluate(c->pc.at(0));
+  VarPtr v2 = evaluate(c->pc.at(1));
+  return calc_lsh(v1, v2);
+}
 
+VarPtr PackageMinosys::calc_lsh(const VarPtr &v1, const VarPtr &v2) {
   switch (v1->vtype) {
   case VT_INT:
     switch (v2->vtype) {
     case VT_INT:
-      return make_shared<Var>(v1->inum << v2->inum);
+      return newVar(v1->inum << v2->inum);
 
     case VT_DNUM:
-      return make_shared<Var>(v1->inum << (int)v2->inum);
+      return newVar(v1->inum << (int)v2->inum);
     }
     break;
 
   case VT_DNUM:
     switch (v2->vtype) {
     case VT_INT:
-      return make_shared<Var>((int)v1->dnum << v2->inum);
+      return newVar((int)v1->dnum << v2->inum);
 
     case VT_DNUM:
-      return make_shared<Var>((int)v1->dnum << (int)v2->dnum);
+      return newVar((int)v1->dnum << (int)v2->dnum);
     }
     break;
 
   case VT_STRING:
     switch (v2->vtype) {
     case VT_INT:
-      return make_shared<Var>(v1->str + createMulString(v2->inum, " "));
+      return newVar(v1->str() + createMulString(v2->inum, " "));
 
     case VT_DNUM:
-      return make_shared<Var>(v1->str + createMulString((int)v2->dnum, " "));
+      return newVar(v1->str() + createMulString((int)v2->dnum, " "));
     }
     break;
   }
 
   // 無効な演算の場合は NULL を返す
-  return make_shared<Var>();
+  return newVar();
 }
 
 // 二項演算子: >>
-shared_ptr<Var> PackageMinosys::eval_op_rsh(Content *c) {
-  shared_ptr<Var> v1 = evaluate(c->pc.at(0));
-  shared_ptr<Var> v2 = evaluate(c->pc.at(1));
+VarPtr PackageMinosys::eval_op_rsh(Content *c) {
+  VarPtr v1 = evaluate(c->pc.at(0));
+  VarPtr v2 = evaluate(c->pc.at(1));
+  return calc_rsh(v1, v2);
+}
 
+VarPtr PackageMinosys::calc_rsh(const VarPtr &v1, const VarPtr &v2) {
   switch (v1->vtype) {
   case VT_INT:
     switch (v2->vtype) {
     case VT_INT:
-      return make_shared<Var>(v1->inum >> v2->inum);
+      return newVar(v1->inum >> v2->inum);
 
     case VT_DNUM:
-      return make_shared<Var>(v1->inum >> (int)v2->dnum);
+      return newVar(v1->inum >> (int)v2->dnum);
     }
     break;
 
   case VT_DNUM:
     switch (v2->vtype) {
     case VT_INT:
-      return make_shared<Var>((int)v1->dnum >> v2->inum);
+      return newVar((int)v1->dnum >> v2->inum);
 
     case VT_DNUM:
-      return make_shared<Var>((int)v1->dnum >> (int)v2->dnum);
+      return newVar((int)v1->dnum >> (int)v2->dnum);
     }
     break;
 
   case VT_STRING:
     switch (v2->vtype) {
     case VT_INT:
-      return make_shared<Var>(createMulString(v2->inum, " ") + v1->str);
+      return newVar(createMulString(v2->inum, " ") + v1->str());
 
     case VT_DNUM:
-      return make_shared<Var>(createMulString((int)v2->dnum, " ") + v1->str);
+      return newVar(createMulString((int)v2->dnum, " ") + v1->str());
     }
     break;
   }
 
   // 無効な演算の場合は NULL を返す
-  return make_shared<Var>();
+  return newVar();
 }
 
 // 文字列 s を count 回繰り返した文字列を返す
@@ -0,0 +1,272 @@
+#ifndef FLATMAP_H_
+#define FLATMAP_H_
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <tuple>
+#include <utility>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace minosys {
+
+// open addressing の hash 表 (SwissTable 方式)
+// 制御バイトを 16 個ずつのグループに分け、hash の下位 7 ビットとまとめて比較して候補を探す
+// 要素は hash 値とともに連続した配列に置くので、追加と走査でノードを確保しない
+// 要素を追加すると、既存の要素への参照と iterator は無効になることがある
+//
+// H と E が K 以外の型も受け付ければ、その型のまま検索できる
+template<class K, class V, class H = std::hash<K>, class E = std::equal_to<K> >
+class FlatMap {
+ public:
+  typedef std::pair<K, V> value_type;
+  enum { GROUP = 16 };
+
+ private:
+  // 制御バイト; 使用中は hash の下位 7 ビット (0x00-0x7f)
+  enum : uint8_t { EMPTY = 0x80, DELETED = 0xfe };
+
+  struct Slot {
+    size_t hash;
+    value_type kv;
+  };
+
+  uint8_t *ctrl;
+  Slot *slots;
+  size_t cap;		// GROUP の倍数の 2 のべき; 0 は未確保
+  size_t count;
+  size_t deleted;
+
+  template<class M, class T> class Iter {
+   public:
+    Iter() : m(NULL), i(0) {}
+    Iter(M *m, size_t i) : m(m), i(i) { skip(); }
+    template<class M2, class T2> Iter(const Iter<M2, T2> &it) : m(it.m), i(it.i) {}
+    T &operator * () const { return m->slots[i].kv; }
+    T *operator -> () const { return &m->slots[i].kv; }
+    Iter &operator ++ () { ++i; skip(); return *this; }
+    bool operator == (const Iter &it) const { return i == it.i; }
+    bool operator != (const Iter &it) const { return i != it.i; }
+
+   private:
+    template<class, class> friend class Iter;
+    friend class FlatMap;
+    M *m;
+    size_t i;
+    void skip() {
+      while (i < m->cap && (m->ctrl[i] & 0x80)) ++i;
+    }
+  };
+
+ public:
+  typedef Iter<FlatMap, value_type> iterator;
+  typedef Iter<const FlatMap, const value_type> const_iterator;
+
+  FlatMap() : ctrl(NULL), slots(NULL), cap(0), count(0), deleted(0) {}
+  FlatMap(const FlatMap &m) : ctrl(NULL), slots(NULL), cap(0), count(0), deleted(0) {
+    if (m.count == 0) return;
+    allocate(m.cap);
+    // 同じ容量なので同じ位置に複製できる
+    for (size_t i = 0; i < cap; ++i) {
+      if (!(m.ctrl[i] & 0x80)) {
+        new (&slots[i]) Slot(m.slots[i]);
+        ctrl[i] = m.ctrl[i];
+      } else if (m.ctrl[i] == DELETED) {
+        ctrl[i] = DELETED;
+      }
+    }
+    count = m.count;
+    deleted = m.deleted;
+  }
+  FlatMap(FlatMap &&m) : ctrl(m.ctrl), slots(m.slots), cap(m.cap), count(m.count), deleted(m.deleted) {
+    m.ctrl = NULL;
+    m.slots = NULL;
+    m.cap = m.count = m.deleted = 0;
+  }
+  ~FlatMap() { destroy(); }
+  FlatMap &operator = (FlatMap m) {
+    swap(m);
+    return *this;
+  }
+  void swap(FlatMap &m) {
+    std::swap(ctrl, m.ctrl);
+    std::swap(slots, m.slots);
+    std::swap(cap, m.cap);
+    std::swap(count, m.count);
+    std::swap(deleted, m.deleted);
+  }
+
+  bool empty() const { return count == 0; }
+  size_t size() const { return count; }
+  iterator begin() { return iterator(this, 0); }
+  iterator end() { return iterator(this, cap); }
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, cap); }
+
+  template<class Q> iterator find(const Q &k) {
+    return iterator(this, lookup(k, mix(H()(k))));
+  }
+  template<class Q> const_iterator find(const Q &k) const {
+    return const_iterator(this, lookup(k, mix(H()(k))));
+  }
+
+  template<class Q, class... A> std::pair<iterator, bool> emplace(Q &&k, A&&... a) {
+    size_t h = mix(H()(k));
+    size_t i = lookup(k, h);
+    if (i != cap) {
+      return std::make_pair(iterator(this, i), false);
+    }
+    if ((count + deleted + 1) * 8 > cap * 7) {
+      // 削除済みが多ければ同じ容量で詰め直す
+      rehash(count * 2 + 2 > cap ? (cap ? cap * 2 : GROUP) : cap);
+    }
+    i = slotFor(h);
+    if (ctrl[i] == DELETED) --deleted;
+    new (&slots[i]) Slot{ h, value_type(std::piecewise_construct, std::forward_as_tuple(std::forward<Q>(k)), std::forward_as_tuple(std::forward<A>(a)...)) };
+    ctrl[i] = (uint8_t)(h & 0x7f);
+    ++count;
+    return std::make_pair(iterator(this, i), true);
+  }
+
+  V &operator [] (const K &k) {
+    return emplace(k).first->second;
+  }
+
+  void erase(iterator it) {
+    slots[it.i].~Slot();
+    ctrl[it.i] = DELETED;
+    --count;
+    ++deleted;
+  }
+
+  void clear() {
+    destroy();
+    ctrl = NULL;
+    slots = NULL;
+    cap = count = deleted = 0;
+  }
+
+  void reserve(size_t n) {
+    size_t c = GROUP;
+    while (c * 7 < n * 8) c *= 2;
+    if (c > cap) rehash(c);
+  }
+
+  bool operator == (const FlatMap &m) const {
+    if (count != m.count) return false;
+    for (const_iterator p = begin(); p != end(); ++p) {
+      const_iterator q = m.find(p->first);
+      if (q == m.end() || !(q->second == p->second)) return false;
+    }
+    return true;
+  }
+  bool operator != (const FlatMap &m) const { return !(*this == m); }
+
+ private:
+  // 弱い hash (整数の恒等写像など) でも上位・下位のビットが散るようにする
+  static size_t mix(size_t h) {
+    h *= 0x9e3779b97f4a7c15ULL;
+    return h ^ (h >> 32);
+  }
+
+  // グループ g の中で制御バイトが b に一致する位置のビット列
+  static uint32_t match(const uint8_t *g, uint8_t b) {
+#if defined(__SSE2__)
+    __m128i v = _mm_loadu_si128((const __m128i *)g);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8((char)b)));
+#else
+    uint32_t m = 0;
+    for (int i = 0; i < GROUP; ++i) {
+      if (g[i] == b) m |= 1u << i;
+    }
+    return m;
+#endif
+  }
+
+  // 空きまたは削除済みの位置のビット列
+  static uint32_t matchFree(const uint8_t *g) {
+#if defined(__SSE2__)
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)g));
+#else
+    uint32_t m = 0;
+    for (int i = 0; i < GROUP; ++i) {
+      if (g[i] & 0x80) m |= 1u << i;
+    }
+    return m;
+#endif
+  }
+
+  // グループを三角数の間隔でたどる; グループ数が 2 のべきなら全グループを一巡する
+  template<class Q> size_t lookup(const Q &k, size_t h) const {
+    if (count == 0) return cap;
+    size_t groups = cap / GROUP;
+    size_t g = (h >> 7) & (groups - 1);
+    uint8_t h2 = (uint8_t)(h & 0x7f);
+    for (size_t step = 1; step <= groups; ++step) {
+      const uint8_t *c = ctrl + g * GROUP;
+      for (uint32_t m = match(c, h2); m; m &= m - 1) {
+        size_t i = g * GROUP + __builtin_ctz(m);
+        if (slots[i].hash == h && E()(slots[i].kv.first, k)) return i;
+      }
+      if (match(c, EMPTY)) break;
+      g = (g + step) & (groups - 1);
+    }
+    return cap;
+  }
+
+  // h を置く位置; 容量に空きがあること
+  size_t slotFor(size_t h) const {
+    size_t groups = cap / GROUP;
+    size_t g = (h >> 7) & (groups - 1);
+    for (size_t step = 1; ; ++step) {
+      uint32_t m = matchFree(ctrl + g * GROUP);
+      if (m) return g * GROUP + __builtin_ctz(m);
+      g = (g + step) & (groups - 1);
+    }
+  }
+
+  void allocate(size_t c) {
+    ctrl = (uint8_t *)std::malloc(c);
+    slots = (Slot *)std::malloc(c * sizeof(Slot));
+    if (!ctrl || !slots) {
+      std::free(ctrl);
+      std::free(slots);
+      throw std::bad_alloc();
+    }
+    std::memset(ctrl, EMPTY, c);
+    cap = c;
+  }
+
+  void rehash(size_t c) {
+    uint8_t *octrl = ctrl;
+    Slot *oslots = slots;
+    size_t ocap = cap;
+    allocate(c);
+    deleted = 0;
+    for (size_t i = 0; i < ocap; ++i) {
+      if (octrl[i] & 0x80) continue;
+      size_t n = slotFor(oslots[i].hash);
+      new (&slots[n]) Slot(std::move(oslots[i]));
+      ctrl[n] = octrl[i];
+      oslots[i].~Slot();
+    }
+    std::free(octrl);
+    std::free(oslots);
+  }
+
+  void destroy() {
+    for (size_t i = 0; i < cap; ++i) {
+      if (!(ctrl[i] & 0x80)) slots[i].~Slot();
+    }
+    std::free(ctrl);
+    std::free(slots);
+  }
+};
+
+} // minosys
+
+#endif // FLATMAP_H_
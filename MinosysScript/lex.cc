@@ -2,29 +2,133 @@
 #include <cstdlib>
 #include <ctype.h>
 #include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 using namespace minosys;
 
+namespace {
+
+// 予約語と VT_* 定数; VT_* は LT_INT として value を返す
+struct Keyword {
+  const char *name;
+  size_t len;
+  LexBase::LexTag tag;
+  int value;
+};
+
+constexpr Keyword keywords[] = {
+  { "this", 4, LexBase::LT_THIS, 0 },
+  { "super", 5, LexBase::LT_SUPER, 0 },
+  { "if", 2, LexBase::LT_IF, 0 },
+  { "else", 4, LexBase::LT_ELSE, 0 },
+  { "for", 3, LexBase::LT_FOR, 0 },
+  { "while", 5, LexBase::LT_WHILE, 0 },
+  { "break", 5, LexBase::LT_BREAK, 0 },
+  { "continue", 8, LexBase::LT_CONTINUE, 0 },
+  { "function", 8, LexBase::LT_FUNCDEF, 0 },
+  { "return", 6, LexBase::LT_RETURN, 0 },
+  { "global", 6, LexBase::LT_GLOBAL, 0 },
+  { "new", 3, LexBase::LT_NEW, 0 },
+  { "class", 5, LexBase::LT_CLASS, 0 },
+  { "import", 6, LexBase::LT_IMPORT, 0 },
+  { "VT_NULL", 7, LexBase::LT_INT, 0 },
+  { "VT_INT", 6, LexBase::LT_INT, 1 },
+  { "VT_STRING", 9, LexBase::LT_INT, 2 },
+  { "VT_INST", 7, LexBase::LT_INT, 3 },
+  { "VT_POINTER", 10, LexBase::LT_INT, 4 },
+  { "VT_ARRAY", 8, LexBase::LT_INT, 5 }
+};
+constexpr size_t NKEYWORDS = sizeof(keywords) / sizeof(keywords[0]);
+
+// 先頭・末尾の文字と長さによる完全ハッシュ
+constexpr size_t KEYWORD_SLOTS = 64;
+constexpr size_t keywordHash(const char *p, size_t len) {
+  return ((unsigned char)p[0] + (unsigned char)p[len - 1] * 5 + len) & (KEYWORD_SLOTS - 1);
+}
+
+constexpr size_t keywordLength(const char *p) {
+  return *p ? 1 + keywordLength(p + 1) : 0;
+}
+
+struct KeywordTable {
+  uint8_t slot[KEYWORD_SLOTS];	// keywords の添字 + 1; 0 は空き
+  bool valid;	// 衝突がなく、len が正しい
+};
+
+constexpr KeywordTable makeKeywordTable() {
+  KeywordTable t = {};
+  t.valid = true;
+  for (size_t i = 0; i < NKEYWORDS; ++i) {
+    size_t h = keywordHash(keywords[i].name, keywords[i].len);
+    if (t.slot[h] || keywordLength(keywords[i].name) != keywords[i].len) t.valid = false;
+    t.slot[h] = (uint8_t)(i + 1);
+  }
+  return t;
+}
+
+constexpr KeywordTable keywordTable = makeKeywordTable();
+static_assert(keywordTable.valid, "bad keyword length, or keywordHash collides");
+
+// 識別子を分類する; 予約語でなければ LT_TAG
+inline LexBase::LexTag keyword(const char *p, size_t len, int &value) {
+  int k = keywordTable.slot[keywordHash(p, len)];
+  if (k && keywords[k - 1].len == len && memcmp(keywords[k - 1].name, p, len) == 0) {
+    value = keywords[k - 1].value;
+    return keywords[k - 1].tag;
+  }
+  return LexBase::LT_TAG;
+}
+
+// [p, end) で最初に c1, c2, c3, '\0' のいずれかが現れる位置; なければ end
+// コメント、文字列定数、HTML の本文を 1 文字ずつ状態遷移せずに読み飛ばす
+inline const char *scanUntil(const char *p, const char *end, char c1, char c2, char c3) {
+#if defined(__AVX2__)
+  const __m256i y1 = _mm256_set1_epi8(c1), y2 = _mm256_set1_epi8(c2), y3 = _mm256_set1_epi8(c3);
+  const __m256i yz = _mm256_setzero_si256();
+  for (; end - p >= 32; p += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)p);
+    __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, y1), _mm256_cmpeq_epi8(x, y2)),
+      _mm256_or_si256(_mm256_cmpeq_epi8(x, y3), _mm256_cmpeq_epi8(x, yz)));
+    unsigned mask = (unsigned)_mm256_movemask_epi8(m);
+    if (mask) return p + __builtin_ctz(mask);
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i x1 = _mm_set1_epi8(c1), x2 = _mm_set1_epi8(c2), x3 = _mm_set1_epi8(c3);
+  const __m128i xz = _mm_setzero_si128();
+  for (; end - p >= 16; p += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)p);
+    __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, x1), _mm_cmpeq_epi8(x, x2)),
+      _mm_or_si128(_mm_cmpeq_epi8(x, x3), _mm_cmpeq_epi8(x, xz)));
+    unsigned mask = (unsigned)_mm_movemask_epi8(m);
+    if (mask) return p + __builtin_ctz(mask);
+  }
+#endif
+  for (; p != end; ++p) {
+    char c = *p;
+    if (c == c1 || c == c2 || c == c3 || c == '\0') break;
+  }
+  return p;
+}
+
+} // namespace
+
 LexBase::LexBase() {
   has_uc = false;
+  f = NULL;
+  base = cur = end = NULL;
+  length = 0;
   uc = 0;
   this->rp = this->state = this->pushstate = 0;
-  tagMap["this"] = LT_THIS;
-  tagMap["super"] = LT_SUPER;
-  tagMap["if"] = LT_IF;
-  tagMap["else"] = LT_ELSE;
-  tagMap["for"] = LT_FOR;
-  tagMap["while"] = LT_WHILE;
-  tagMap["break"] = LT_BREAK;
-  tagMap["continue"] = LT_CONTINUE;
-  tagMap["function"] = LT_FUNCDEF;
-  tagMap["return"] = LT_RETURN;
-  tagMap["global"] = LT_GLOBAL;
-  tagMap["new"] = LT_NEW;
-  tagMap["class"] = LT_CLASS;
-  tagMap["import"] = LT_IMPORT;
-  tagMap["function"] = LT_FUNCDEF;
 }
 
 void LexBase::ungetc(int c) {
@@ -32,6 +136,50 @@ void LexBase::ungetc(int c) {
   uc = c;
 }
 
+LexMap::LexMap(const string &path) : map(NULL), maplen(0) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return;
+  struct stat sb;
+  if (fstat(fd, &sb) == 0) {
+    mapRegion(fd, 0, (size_t)sb.st_size);
+  }
+  close(fd);
+}
+
+LexMap::LexMap(int fd, long offset, size_t len) : map(NULL), maplen(0) {
+  mapRegion(fd, offset, len);
+}
+
+LexMap::~LexMap() {
+  if (map) {
+    munmap(map, maplen);
+  }
+}
+
+// offset はページ境界に切り下げて map し、先頭のずれは base で吸収する
+void LexMap::mapRegion(int fd, long offset, size_t len) {
+  if (len == 0) return;
+  long page = sysconf(_SC_PAGESIZE);
+  long delta = offset % page;
+  maplen = len + delta;
+  map = mmap(NULL, maplen, PROT_READ, MAP_PRIVATE, fd, offset - delta);
+  if (map == MAP_FAILED) {
+    map = NULL;
+    maplen = 0;
+    return;
+  }
+  madvise(map, maplen, MADV_SEQUENTIAL);
+  setBuffer((const char *)map + delta, len);
+}
+
+// バッファの残りから c1, c2, c3 の手前までをまとめて token に追加する
+void LexBase::appendUntil(char c1, char c2, char c3) {
+  if (cur == end) return;
+  const char *p = scanUntil(cur, end, c1, c2, c3);
+  token.append(cur, p - cur);
+  cur = p;
+}
+
 LexBase::LexTag LexBase::analyze() {
   bool isDnum = false, isHTML = false;
   int c;
@@ -131,12 +279,16 @@ LexBase::LexTag LexBase::analyze() {
     case 10:
       if (c == '\n') {
         this->state = 0;
+      } else {
+        cur = scanUntil(cur, end, '\n', '\n', '\n');
       }
       break;
 
     case 12:
       if (c == '*') {
         this->state = 13;
+      } else {
+        cur = scanUntil(cur, end, '*', '*', '*');
       }
       break;
 
@@ -155,35 +307,7 @@ LexBase::LexTag LexBase::analyze() {
       } else {
         this->ungetc(c);
         this->state = 0;
-        if (token == "VT_NULL") {
-          itoken = 0;
-          return LT_INT;
-        }
-        if (token == "VT_INT") {
-          itoken = 1;
-          return LT_INT;
-        }
-        if (token == "VT_STRING") {
-          itoken = 2;
-          return LT_INT;
-        }
-        if (token == "VT_INST") {
-          itoken = 3;
-          return LT_INT;
-        }
-        if (token == "VT_POINTER") {
-          itoken = 4;
-          return LT_INT;
-        }
-        if (token == "VT_ARRAY") {
-          itoken = 5;
-          return LT_INT;
-        }
-        auto p = tagMap.find(token);
-        if (p != tagMap.end()) {
-          return p->second;
-        }
-        return LT_TAG;
+        return keyword(token.data(), token.size(), itoken);
       }
       break;
 
@@ -202,6 +326,7 @@ LexBase::LexTag LexBase::analyze() {
         this->state = 41;
       } else if (c != '"') {
         token.push_back(c);
+        appendUntil('"', '\\', '"');
       } else {
         this->state = 0;
         return LT_STRING;
@@ -224,6 +349,7 @@ LexBase::LexTag LexBase::analyze() {
         this->state = 51;
       } else if (c != '\'') {
         token.push_back(c);
+        appendUntil('\'', '\\', '\'');
       } else {
         this->state = 0;
         return LT_STRING;
@@ -460,6 +586,7 @@ LexBase::LexTag LexBase::analyze() {
         this->state = 121;
       } else {
         token.push_back((char)c);
+        appendUntil('$', '$', '$');
       }
       break;
 
@@ -518,6 +645,45 @@ LexBase::LexTag LexBase::analyze() {
   return LT_NULL;
 }
 
+// ソース全体を buf に字句解析する
+// トークンの文字列がソースの一部と一致すれば、その位置だけを記録する
+void LexBase::tokenize(TokenBuffer &buf) {
+  LexTag tag;
+  buf.src = base;
+  do {
+    tag = analyze();
+    Token t;
+    t.tag = (uint8_t)tag;
+    t.extra = 0;
+    if (tag == LT_INT) {
+      t.inum = itoken;
+    } else if (tag == LT_DNUM) {
+      t.dnum = dtoken;
+    } else {
+      size_t n = token.size();
+      t.span.length = (uint32_t)n;
+      t.span.offset = 0;
+      bool found = n == 0;
+      if (!found && base) {
+        // 先読みした 1 文字や閉じ引用符の分だけ手前で終わっている
+        size_t e = (size_t)(cur - base) - (has_uc ? 1 : 0);
+        for (size_t back = 0; back < 2 && !found && e >= n + back; ++back) {
+          if (memcmp(base + e - back - n, token.data(), n) == 0) {
+            t.span.offset = (uint32_t)(e - back - n);
+            found = true;
+          }
+        }
+      }
+      if (!found) {
+        t.extra = 1;
+        t.span.offset = (uint32_t)buf.extra.size();
+        buf.extra.append(token);
+      }
+    }
+    buf.tokens.push_back(t);
+  } while (tag != LT_NULL);
+}
+
 #ifdef DEBUG
 int main() {
   const static char q[] = "test($x, $y) { return $x + $y - 100.0; }";
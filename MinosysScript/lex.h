@@ -2,12 +2,62 @@
 #define LEXBASE_H_
 
 #include <cstdio>
-#include <cstdio>
+#include <cstdint>
+#include <cstring>
 #include <string>
-#include <unordered_map>
+#include <vector>
 
 namespace minosys {
 
+// トークンの文字列; ソースのバッファか TokenBuffer::extra の中を指す
+class TokenText {
+ public:
+  TokenText() : p(""), n(0) {}
+  TokenText(const char *p, size_t n) : p(p), n(n) {}
+  const char *data() const { return p; }
+  size_t size() const { return n; }
+  bool empty() const { return n == 0; }
+  std::string str() const { return std::string(p, n); }
+  operator std::string () const { return str(); }
+  bool operator == (const char *s) const { return std::strlen(s) == n && std::memcmp(p, s, n) == 0; }
+  bool operator != (const char *s) const { return !(*this == s); }
+  bool operator == (const std::string &s) const { return s.size() == n && std::memcmp(p, s.data(), n) == 0; }
+  bool operator != (const std::string &s) const { return !(*this == s); }
+
+ private:
+  const char *p;
+  size_t n;
+};
+
+// 字句解析済みのトークン; 数値以外は文字列の位置と長さだけを持つ
+struct Token {
+  union {
+    struct {
+      uint32_t offset, length;
+    } span;
+    int inum;
+    double dnum;
+  };
+  uint8_t tag;		// LexBase::LexTag
+  uint8_t extra;	// span が TokenBuffer::extra を指す
+};
+
+// パッケージ全体のトークン列
+class TokenBuffer {
+ public:
+  std::vector<Token> tokens;
+  const char *src;	// LexBase::data()
+  std::string extra;	// ソースと一致しないトークンの文字列 (エスケープを含む文字列定数など)
+  TokenBuffer() : src(NULL) {}
+  size_t size() const { return tokens.size(); }
+  const Token &operator [] (size_t i) const { return tokens[i]; }
+  TokenText text(size_t i) const {
+    const Token &t = tokens[i];
+    if (t.span.length == 0) return TokenText();
+    return TokenText((t.extra ? extra.data() : src) + t.span.offset, t.span.length);
+  }
+};
+
 class LexBase {
  public:
   enum LexTag {
@@ -18,41 +68,82 @@ class LexBase {
   int itoken;
   double dtoken;
   LexTag analyze();
+  void tokenize(TokenBuffer &buf);
 
  protected:
   int uc, state, pushstate, rp;
   bool has_uc;
   FILE *f;
-  virtual int getc() = 0;
+  const char *base;	// 全体を保持するソースの先頭; ストリームでは NULL
+  size_t length;
+  const char *cur, *end;	// 読み込み位置
+  int getc() {
+    if (has_uc) {
+      has_uc = false;
+      return uc;
+    }
+    if (cur != end) {
+      return (int)*cur++ & 255;
+    }
+    return fill();
+  }
+  // cur..end を読み切った時に呼ばれる; 次の文字を返す (-1: 終了)
+  virtual int fill() { return -1; }
   void ungetc(int c);
+  void appendUntil(char c1, char c2, char c3);
 
- private:
-  std::unordered_map<std::string, LexTag> tagMap;
+ public:
+  // ソース全体のバッファ; トークンの位置はこの中を指す
+  const char *data() const { return base; }
+  size_t size() const { return length; }
 };
 
+// メモリ上の文字列を解析する
 class LexString : public LexBase {
  public:
-  LexString(const char *p, int len) {
-    this->p = p;
-    this->len = len;
-    this->pos = 0;
+  LexString(const char *p, size_t len) {
+    setBuffer(p, len);
   }
 
- private:
-  const char *p;
-  int pos, len;
-  int getc() {
-    if (has_uc) {
-      has_uc = false;
-      return uc;
-    }
-    if (pos == len) {
-      return -1;
-    }
-    return (int)p[pos++] & 255;
+ protected:
+  LexString() {}
+  void setBuffer(const char *p, size_t len) {
+    base = cur = p;
+    length = len;
+    end = p + len;
+  }
+};
+
+// 引き取った文字列を解析する
+class LexBuffer : public LexString {
+ public:
+  LexBuffer(std::string &&s) : buf(std::move(s)) {
+    setBuffer(buf.data(), buf.size());
   }
+
+ private:
+  std::string buf;
+  LexBuffer(const LexBuffer &);
+  LexBuffer &operator = (const LexBuffer &);
+};
+
+// ファイル、またはファイルの一部を mmap して解析する
+class LexMap : public LexString {
+ public:
+  LexMap(const std::string &path);
+  LexMap(int fd, long offset, size_t len);
+  ~LexMap();
+  bool valid() const { return map != NULL || length == 0; }
+
+ private:
+  void *map;
+  size_t maplen;
+  void mapRegion(int fd, long offset, size_t len);
+  LexMap(const LexMap &);
+  LexMap &operator = (const LexMap &);
 };
 
+// mmap できないストリーム (pipe など) をまとめて読み込んで解析する
 class LexFile : public LexBase {
  public:
   LexFile(std::FILE *f) {
@@ -60,13 +151,17 @@ class LexFile : public LexBase {
   }
 
  private:
+  enum { BUFSIZE = 8192 };
   std::FILE *f;
-  int getc() {
-    if (has_uc) {
-      has_uc = false;
-      return uc;
+  char buf[BUFSIZE];
+  int fill() {
+    size_t n = std::fread(buf, 1, BUFSIZE, f);
+    if (n == 0) {
+      return -1;
     }
-    return std::fgetc(f);
+    cur = buf;
+    end = buf + n;
+    return (int)*cur++ & 255;
   }
 };
 
@@ -1,5 +1,6 @@
 #include "engine.h"
 #include <iostream>
+#include <cstdlib>
 #include <unistd.h>
 #include <vector>
 #include <string>
@@ -12,8 +13,13 @@ int main(int argc, char **argv) {
   vector<string> sp;
   int c;
   string ar;
+  bool tree = false;
+  bool stats = false;
+  bool nocache = false;
+  bool lazy = false;
+  int threads = 0;
 
-  while ((c = getopt(argc, argv, "a:d:")) != -1) {
+  while ((c = getopt(argc, argv, "a:d:j:lnst")) != -1) {
     switch (c) {
     case 'a':
       ar = optarg;
@@ -22,6 +28,31 @@ int main(int argc, char **argv) {
     case 'd':
       sp.push_back(optarg);
       break;
+
+    case 'j':
+      // import されたパッケージを読み込むスレッド数; 0 ならコア数
+      threads = atoi(optarg);
+      break;
+
+    case 'l':
+      // 関数本体の構文解析を最初の呼び出しまで遅らせる
+      lazy = true;
+      break;
+
+    case 'n':
+      // 構文解析のキャッシュを使わない
+      nocache = true;
+      break;
+
+    case 's':
+      // 終了時に Var の確保回数を表示する
+      stats = true;
+      break;
+
+    case 't':
+      // bytecode VM ではなく tree walker で実行する
+      tree = true;
+      break;
     }
   }
 
@@ -29,20 +60,32 @@ int main(int argc, char **argv) {
   argv += optind;
 
   if (argc < 1) {
-    cout << "usage: minosysscr [-a <ar>][-d <dir>] <file>" << endl;
+    cout << "usage: minosysscr [-a <ar>][-d <dir>][-j <threads>][-l][-n][-s][-t] <file>" << endl;
     return 1;
   }
 
   Engine eng(sp);
+  eng.useBytecode = !tree;
+  eng.useCache = !nocache;
+  eng.lazyParse = lazy;
+  eng.loaderThreads = threads;
   eng.setArchive(argv[0]);
   if (!eng.analyzePackage(argv[0], true)) {
     cout << "package:" << argv[0] << " not found" << endl;
     return 1;
   }
-  vector<shared_ptr<Var> > args;
+  if (stats) {
+    // パッケージごとの構文木の大きさ
+    for (auto p = eng.packages.begin(); p != eng.packages.end(); ++p) {
+      if (p->first.empty() || p->second->ptype != PackageBase::PT_MINOSYS) continue;
+      Arena &arena = static_cast<PackageMinosys *>(p->second.get())->top->arena;
+      cerr << "package " << p->first << ": " << arena.nodes << " nodes, " << arena.bytes << " bytes" << endl;
+    }
+  }
+  vector<VarPtr> args;
   try {
-    shared_ptr<Var> r = eng.start(argv[0], "init", args);
-    cout << "return type: " << r->vtype << endl;
+    VarPtr r = eng.start(argv[0], "init", args);
+    cout << "return type: " << (int)r->vtype << endl;
     switch (r->vtype) {
     case VT_INT:
       cout << "return value:" << r->inum << endl;
@@ -53,12 +96,15 @@ int main(int argc, char **argv) {
       break;
 
     case VT_STRING:
-      cout << "return value:" << r->str << endl;
+      cout << "return value:" << r->str() << endl;
       break;
     }
   } catch (const RuntimeException &e) {
     cout << "RuntimeException: number=" << e.e << ", message=" << e.er << endl;
   }
+  if (stats) {
+    cerr << "var allocations: " << VarPool::allocs << ", heap allocations: " << VarPool::heapallocs << endl;
+  }
   return 0;
 }
 
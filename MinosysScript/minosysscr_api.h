@@ -1,8 +1,33 @@
 #ifndef MINOSYSSCR_API_H_
+#define MINOSYSSCR_API_H_
 
-// int start(Var **, Engine *, const char *, vector<Var> *);
+// int start(Var **, Engine *, const char *, vector<VarPtr> *);
+// *pret には new Var で作成した値を返す; 所有権は呼び出し側へ移る
 // 関数の実行
 extern "C" int start(void **pret, void *engine, const char *fname, void *args);
 
-#endif // MINOSYSSCR_API_H_
+// 高速呼び出し ABI
+// モジュールは minosys_module_init を公開し、読み込み時に関数表を登録する
+// 登録した関数は名前を引かず、引数の vector も作らずに直接呼び出される
+#define MINOSYS_ABI_VERSION 1
+
+// int f(Var **, Engine *, Var *const *, int);
+// args は呼び出し中のみ有効な借用; *pret は start と同じく new Var で作成する
+typedef int (*minosys_fastfunc)(void **pret, void *engine, void *const *args, int nargs);
+
+struct minosys_function {
+  const char *name;
+  int nargs;	// 引数の数; -1 は可変長
+  minosys_fastfunc func;
+};
 
+struct minosys_module {
+  int version;	// MINOSYS_ABI_VERSION
+  int nfuncs;
+  const minosys_function *funcs;
+};
+
+// version は Engine の MINOSYS_ABI_VERSION; 対応できなければ NULL を返す
+extern "C" const minosys_module *minosys_module_init(int version);
+
+#endif // MINOSYSSCR_API_H_
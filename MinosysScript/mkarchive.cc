@@ -0,0 +1,240 @@
+#include "engine.h"
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <vector>
+#include <string>
+
+using namespace std;
+using namespace minosys;
+
+// ソースツリーから mpk2 アーカイブを作る
+// キーはディレクトリからの相対パスから ".minosys" を除いたもの (import の名前と同じ)
+// 要素表はキー順に並べ、本体は 8 バイト境界に置く
+
+struct Entry {
+  string key;
+  string value;
+};
+
+static const char SUFFIX[] = ".minosys";
+
+static bool endsWith(const string &s, const string &t) {
+  return s.size() >= t.size() && s.compare(s.size() - t.size(), t.size(), t) == 0;
+}
+
+static bool readFile(const string &path, string &out) {
+  FILE *f = fopen(path.c_str(), "rb");
+  if (!f) return false;
+  char buf[8192];
+  size_t n;
+  out.clear();
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    out.append(buf, n);
+  }
+  bool ok = !ferror(f);
+  fclose(f);
+  return ok;
+}
+
+// dir 以下の *.minosys を集める; skip (出力先) は除く
+static void walk(const string &dir, const string &prefix, const string &skip, vector<pair<string, string> > &files) {
+  DIR *d = opendir(dir.c_str());
+  if (!d) return;
+  struct dirent *e;
+  while ((e = readdir(d)) != NULL) {
+    string name = e->d_name;
+    if (name == "." || name == "..") continue;
+    string path = dir + "/" + name;
+    struct stat sb;
+    if (stat(path.c_str(), &sb) < 0) continue;
+    if (S_ISDIR(sb.st_mode)) {
+      walk(path, prefix + name + "/", skip, files);
+    } else if (S_ISREG(sb.st_mode) && endsWith(name, SUFFIX)) {
+      char real[PATH_MAX];
+      if (realpath(path.c_str(), real) && skip == real) continue;
+      files.push_back(make_pair(prefix + name.substr(0, name.size() - strlen(SUFFIX)), path));
+    }
+  }
+  closedir(d);
+}
+
+// 先頭に展開後の長さを付けて圧縮する; 小さくならなければ false
+static bool compress(const string &in, string &out) {
+  uLongf n = compressBound((uLong)in.size());
+  uint32_t rawlen = (uint32_t)in.size();
+  out.resize(sizeof(rawlen) + n);
+  memcpy(&out[0], &rawlen, sizeof(rawlen));
+  if (compress2((Bytef *)&out[sizeof(rawlen)], &n, (const Bytef *)in.data(), (uLong)in.size(), Z_BEST_COMPRESSION) != Z_OK) {
+    return false;
+  }
+  out.resize(sizeof(rawlen) + n);
+  return out.size() < in.size();
+}
+
+// 出力先の絶対パス; 出力先が dir の中にあっても読み込まないよう walk で比べる
+// ファイルはまだないことがあるので、親ディレクトリを解決して名前を付け足す
+static string outputPath(const string &path) {
+  size_t slash = path.rfind('/');
+  string dir = slash == string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+  string name = slash == string::npos ? path : path.substr(slash + 1);
+  char real[PATH_MAX];
+  if (!realpath(dir.c_str(), real)) return string();
+  string r = real;
+  if (r.empty() || r[r.size() - 1] != '/') r += "/";
+  return r + name;
+}
+
+static void addEntry(vector<Entry> &entries, const string &name, Engine::Archive::Kind kind, const string &value, bool compressed) {
+  Entry e;
+  string z;
+  if (compressed && compress(value, z)) {
+    e.key = Engine::Archive::key(name, kind, true);
+    e.value.swap(z);
+  } else {
+    e.key = Engine::Archive::key(name, kind, false);
+    e.value = value;
+  }
+  entries.push_back(e);
+}
+
+static size_t align8(size_t n) {
+  return (n + 7) & ~(size_t)7;
+}
+
+static bool writeArchive(const string &path, vector<Entry> &entries) {
+  sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.key < b.key; });
+
+  size_t table = 8;
+  size_t pos = table + entries.size() * sizeof(Engine::Archive::Elem);
+  vector<Engine::Archive::Elem> elems(entries.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    elems[i].key_offset = (int32_t)pos;
+    elems[i].key_length = (int32_t)entries[i].key.size();
+    pos += entries[i].key.size();
+  }
+  for (size_t i = 0; i < entries.size(); ++i) {
+    pos = align8(pos);
+    elems[i].val_offset = (int32_t)pos;
+    elems[i].val_length = (int32_t)entries[i].value.size();
+    pos += entries[i].value.size();
+  }
+  if (pos > INT32_MAX) {
+    cerr << "minosysar: archive too large" << endl;
+    return false;
+  }
+
+  string out;
+  out.reserve(pos);
+  out.append("mpk2", 4);
+  int32_t n = (int32_t)entries.size();
+  out.append((const char *)&n, sizeof(n));
+  out.append((const char *)elems.data(), elems.size() * sizeof(Engine::Archive::Elem));
+  for (auto p = entries.begin(); p != entries.end(); ++p) {
+    out.append(p->key);
+  }
+  for (size_t i = 0; i < entries.size(); ++i) {
+    out.resize(elems[i].val_offset, '\0');
+    out.append(entries[i].value);
+  }
+
+  // 書き込み途中のファイルを読まれないよう rename で置き換える
+  // 一時ファイルは同時に走る他の minosysar と重ならないよう mkstemp で作る
+  string tmp = path + ".XXXXXX";
+  int fd = mkstemp(&tmp[0]);
+  if (fd < 0) {
+    cerr << "minosysar: cannot create " << tmp << endl;
+    return false;
+  }
+  fchmod(fd, 0644);
+  FILE *f = fdopen(fd, "wb");
+  if (!f) {
+    close(fd);
+    unlink(tmp.c_str());
+    cerr << "minosysar: cannot open " << tmp << endl;
+    return false;
+  }
+  bool ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+  ok = (fclose(f) == 0) && ok;
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+    unlink(tmp.c_str());
+    cerr << "minosysar: cannot write " << path << endl;
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  int c;
+  bool precompile = false;
+  bool compressed = false;
+  bool verbose = false;
+
+  while ((c = getopt(argc, argv, "cvz")) != -1) {
+    switch (c) {
+    case 'c':
+      // 事前コンパイル済みの構文木を各ソースに添える
+      precompile = true;
+      break;
+
+    case 'v':
+      verbose = true;
+      break;
+
+    case 'z':
+      // 小さくなる要素は zlib で圧縮する
+      compressed = true;
+      break;
+    }
+  }
+
+  argc -= optind;
+  argv += optind;
+
+  if (argc < 2) {
+    cout << "usage: minosysar [-c][-v][-z] <archive> <dir>" << endl;
+    return 1;
+  }
+
+  string arpath = argv[0];
+  string skip = outputPath(arpath);
+
+  vector<pair<string, string> > files;
+  walk(argv[1], "", skip, files);
+
+  vector<Entry> entries;
+  for (auto p = files.begin(); p != files.end(); ++p) {
+    string src;
+    if (!readFile(p->second, src)) {
+      cerr << "minosysar: cannot read " << p->second << endl;
+      return 1;
+    }
+    if (src.compare(0, 4, "\177ELF") == 0) {
+      // binary package はアーカイブから読み込めない
+      cerr << "minosysar: skip binary package " << p->second << endl;
+      continue;
+    }
+    addEntry(entries, p->first, Engine::Archive::SOURCE, src, compressed);
+    if (precompile) {
+      ContentTop top;
+      LexString lex(src.data(), src.size());
+      string blob;
+      if (top.yylex(&lex) && top.encodeCache(blob, SourceStamp())) {
+        addEntry(entries, p->first, Engine::Archive::COMPILED, blob, compressed);
+      } else {
+        cerr << "minosysar: cannot precompile " << p->second << endl;
+      }
+    }
+    if (verbose) {
+      cerr << p->first << endl;
+    }
+  }
+  return writeArchive(arpath, entries) ? 0 : 1;
+}
@@ -0,0 +1,211 @@
+#include "engine.h"
+#include "bytecode.h"
+
+using namespace std;
+using namespace minosys;
+
+// bytecode の実行
+VarPtr PackageMinosys::execute(ByteCode *bc) {
+  vector<VarPtr> regs(bc->nregs);
+  const Instruction *code = bc->code.data();
+  const Instruction *ip = code;
+
+  while (true) {
+    const Instruction &i = *ip++;
+    switch (i.code) {
+    case OC_NOP:
+      break;
+
+    case OC_LOADNULL:
+      regs[i.a] = newVar();
+      break;
+
+    case OC_LOADINT:
+      regs[i.a] = newVar((int)i.b);
+      break;
+
+    case OC_LOADDNUM:
+      regs[i.a] = newVar(bc->dnums[i.b]);
+      break;
+
+    case OC_LOADSTR:
+      regs[i.a] = newVar(bc->strs[i.b]);
+      break;
+
+    case OC_LOADCONST:
+      regs[i.a] = consts[i.b];
+      break;
+
+    case OC_LOADFUNC:
+      {
+        FuncRef f = { (Symbol)i.b, (Symbol)i.c };
+        regs[i.a] = newVar(f);
+      }
+      break;
+
+    case OC_FUNCTAG:
+      {
+        FuncRef f = { eng->currentPackage, (Symbol)i.b };
+        regs[i.a] = newVar(f);
+      }
+      break;
+
+    case OC_MEMBER:
+      regs[i.a] = newVar(MemberPair(regs[i.a], (Symbol)i.b));
+      break;
+
+    case OC_GETVAR:
+      regs[i.a] = eng->searchVar(bc->nodes[i.b]);
+      break;
+
+    case OC_DECLVAR:
+      createVar(bc->nodes[i.b], &regs[i.c], i.n);
+      break;
+
+    case OC_JNARRAY:
+      if (regs[i.a]->vtype != VT_ARRAY) {
+        ip = code + i.b;
+      }
+      break;
+
+    case OC_INDEX:
+      if (!findIndex(regs[i.a], regs[i.c])) {
+        ip = code + i.b;
+      }
+      break;
+
+    case OC_EVAL:
+      regs[i.a] = evaluate(bc->nodes[i.b]);
+      break;
+
+    case OC_NOT:
+      regs[i.a] = calc_monoNot(regs[i.b]);
+      break;
+
+    case OC_NEGATE:
+      regs[i.a] = calc_negate(regs[i.b]);
+      break;
+
+    case OC_MINUS:
+      regs[i.a] = calc_monoMinus(regs[i.b]);
+      break;
+
+    case OC_TRUTH:
+      regs[i.a] = newVar(regs[i.b]->isTrue() ? 1 : (int)0);
+      break;
+
+#define CASE_CALC2(oc, x) \
+    case oc: \
+      regs[i.a] = calc_##x(regs[i.b], regs[i.c]); \
+      break;
+
+    CASE_CALC2(OC_LT, lt)
+    CASE_CALC2(OC_LTEQ, lteq)
+    CASE_CALC2(OC_GT, gt)
+    CASE_CALC2(OC_GTEQ, gteq)
+    CASE_CALC2(OC_NEQ, neq)
+    CASE_CALC2(OC_EQ, eq)
+    CASE_CALC2(OC_PLUS, plus)
+    CASE_CALC2(OC_MINUS2, minus)
+    CASE_CALC2(OC_MULTIPLY, multiply)
+    CASE_CALC2(OC_DIV, div)
+    CASE_CALC2(OC_MOD, mod)
+    CASE_CALC2(OC_AND, and)
+    CASE_CALC2(OC_OR, or)
+    CASE_CALC2(OC_XOR, xor)
+    CASE_CALC2(OC_LSH, lsh)
+    CASE_CALC2(OC_RSH, rsh)
+
+    case OC_ASSIGN:
+      {
+        VarPtr &v = createVar(bc->nodes[i.b], &regs[i.c], i.n);
+        v = bindVar(regs[i.a]);
+      }
+      break;
+
+#define CASE_ASSIGN(oc, x) \
+    case oc: \
+      { \
+        VarPtr &v = createVar(bc->nodes[i.b], &regs[i.c], i.n); \
+        regs[i.a] = calc_##x(v, regs[i.a]); \
+      } \
+      break;
+
+    CASE_ASSIGN(OC_ASSIGNPLUS, assignplus)
+    CASE_ASSIGN(OC_ASSIGNMINUS, assignminus)
+    CASE_ASSIGN(OC_ASSIGNMULTIPLY, assignmultiply)
+    CASE_ASSIGN(OC_ASSIGNDIV, assigndiv)
+    CASE_ASSIGN(OC_ASSIGNMOD, assignmod)
+    CASE_ASSIGN(OC_ASSIGNAND, assignand)
+    CASE_ASSIGN(OC_ASSIGNOR, assignor)
+    CASE_ASSIGN(OC_ASSIGNXOR, assignxor)
+    CASE_ASSIGN(OC_ASSIGNLSH, assignlsh)
+    CASE_ASSIGN(OC_ASSIGNRSH, assignrsh)
+
+#define CASE_INCR(oc, x) \
+    case oc: \
+      regs[i.a] = calc_##x(createVar(bc->nodes[i.b], &regs[i.c], i.n)); \
+      break;
+
+    CASE_INCR(OC_PREINCR, preIncr)
+    CASE_INCR(OC_POSTINCR, postIncr)
+    CASE_INCR(OC_PREDECR, preDecr)
+    CASE_INCR(OC_POSTDECR, postDecr)
+
+    case OC_JMP:
+      ip = code + i.b;
+      break;
+
+    case OC_JMPF:
+      if (!regs[i.a]->isTrue()) {
+        ip = code + i.b;
+      }
+      break;
+
+    case OC_JMPT:
+      if (regs[i.a]->isTrue()) {
+        ip = code + i.b;
+      }
+      break;
+
+    case OC_CALLPREP:
+      {
+        vector<VarPtr> recv;
+        prepareCall(regs[i.a], recv);
+        regs[i.a + 1] = recv.empty() ? VarPtr() : recv.front();
+      }
+      break;
+
+    case OC_CALL:
+      if (!regs[i.a + 1] && regs[i.a]->vtype == VT_FUNC && i.n <= PackageDlopen::MAXFASTARGS) {
+        // 高速呼び出し ABI のネイティブ関数は引数のレジスタをそのまま渡す
+        FuncRef f = regs[i.a]->func();
+        PackageDlopen *pd;
+        const PackageDlopen::Native *n = eng->findFast(f, pd);
+        if (n) {
+          regs[i.b] = invokeFast(pd, *n, f, regs.data() + i.a + 2, i.n);
+          break;
+        }
+      }
+      {
+        vector<VarPtr> args;
+        args.reserve(i.n + 1);
+        // 引数のレジスタは呼び出し専用なので move してよい
+        if (regs[i.a + 1]) {
+          args.push_back(std::move(regs[i.a + 1]));
+        }
+        for (int k = 0; k < i.n; ++k) {
+          args.push_back(std::move(regs[i.a + 2 + k]));
+        }
+        regs[i.b] = invoke(regs[i.a], args);
+      }
+      break;
+
+    case OC_RET:
+      return regs[i.a];
+
+    case OC_RETNULL:
+      return newVar();
+    }
+  }
+}